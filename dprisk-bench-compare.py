@@ -0,0 +1,54 @@
+#
+# Compare two dprisk-bench result files and flag regressions.
+#
+# EXAMPLES:
+#   ./dprisk-bench > baseline.json
+#   ./dprisk-bench > current.json
+#   python dprisk-bench-compare.py baseline.json current.json
+#   python dprisk-bench-compare.py baseline.json current.json --tolerance 0.05 --mads 3
+#
+# A benchmark regresses if its median time grew by more than the relative
+# tolerance AND by more than the given number of MADs (the larger of the two
+# runs), so that noisy benchmarks are not flagged for noise alone. The exit
+# status is 1 if there is any regression, 0 otherwise.
+#
+
+import sys
+import json
+import argparse
+
+if __name__ == '__main__':
+
+  parser = argparse.ArgumentParser()
+
+  parser.add_argument('baseline', type = str, help = 'stored dprisk-bench JSON results')
+  parser.add_argument('current', type = str, help = 'new dprisk-bench JSON results')
+  parser.add_argument('--tolerance', type = float, default = 0.10, help = 'allowed relative slowdown of the median')
+  parser.add_argument('--mads', type = float, default = 3.0, help = 'slowdown must also exceed this many MADs')
+
+  args = parser.parse_args()
+
+  with open(args.baseline) as f:
+    baseline = {r['name']: r for r in json.load(f)['results']}
+  with open(args.current) as f:
+    current = {r['name']: r for r in json.load(f)['results']}
+
+  regressions = 0
+  print('{:32s} {:>12s} {:>12s} {:>8s}'.format('benchmark', 'baseline s', 'current s', 'change'))
+  for name, cur in current.items():
+    if name not in baseline:
+      print('{:32s} {:>12s} {:12.6g} {:>8s}'.format(name, '-', cur['median_s'], 'new'))
+      continue
+    base = baseline[name]
+    change = cur['median_s'] / base['median_s'] - 1.0 if base['median_s'] > 0 else 0.0
+    noise = args.mads * max(base['mad_s'], cur['mad_s'])
+    slower = change > args.tolerance and cur['median_s'] - base['median_s'] > noise
+    regressions += slower
+    print('{:32s} {:12.6g} {:12.6g} {:+7.1f}%{}'.format(name, base['median_s'], cur['median_s'], 100.0 * change,
+                                                        '  REGRESSION' if slower else ''))
+  for name in baseline:
+    if name not in current:
+      print('{:32s} {:12.6g} {:>12s} {:>8s}'.format(name, baseline[name]['median_s'], '-', 'missing'))
+
+  print('{} regression(s)'.format(regressions))
+  sys.exit(1 if regressions > 0 else 0)
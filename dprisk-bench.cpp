@@ -0,0 +1,280 @@
+/*
+ * Benchmark suite for the stages of dprisk.cpp: transition table
+ * construction, the DP solvers, the simulators and the table writers.
+ *
+ * COMPILE: g++ -Wall -O2 -pthread -o dprisk-bench dprisk-bench.cpp
+ * USAGE: ./dprisk-bench [--warmup W] [--reps R] [--threads T] [--quick]
+ *                       [--filter text] [> results.json]
+ *
+ * --warmup W     untimed runs before the timed ones (default 1)
+ * --reps R       timed runs per benchmark (default 5)
+ * --threads T    threads for the parallel solvers (default: hardware concurrency)
+ * --quick        small grids only (for a smoke test)
+ * --filter text  run only the benchmarks whose name contains text
+ *
+ * Output (standard output) is JSON: the settings, and for every benchmark
+ * its name, the unit of work, the amount of work per run, the median and
+ * the median absolute deviation (MAD) of the run times in seconds, and
+ * the throughput (work / median). Compare two result files with
+ * dprisk-bench-compare.py. Progress goes to standard error.
+ */
+
+#define DPRISK_NO_MAIN
+#include "dprisk.cpp"
+
+#include <chrono>
+
+struct bench_result {
+  std::string name;
+  std::string unit;     // what items counts: cells, battles, rounds, bytes, ...
+  double items;         // per run
+  int warmup;
+  int reps;
+  double median;        // seconds
+  double mad;           // seconds
+};
+
+double median_of(std::vector<double> x) {
+  std::sort(x.begin(), x.end());
+  const size_t n = x.size();
+  return (n % 2 == 1 ? x[n / 2] : 0.5 * (x[n / 2 - 1] + x[n / 2]));
+}
+
+template <typename Func>
+bench_result run_bench(const std::string& name,
+                       const std::string& unit,
+                       double items,
+                       int warmup,
+                       int reps,
+                       Func f)
+{
+  for (int i = 0; i < warmup; i++)
+    f();
+  std::vector<double> times(reps);
+  for (int i = 0; i < reps; i++) {
+    const auto t0 = std::chrono::steady_clock::now();
+    f();
+    times[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  }
+  const double med = median_of(times);
+  std::vector<double> dev(reps);
+  for (int i = 0; i < reps; i++)
+    dev[i] = std::fabs(times[i] - med);
+  std::cerr << name << ": " << med << " s" << std::endl;
+  return {name, unit, items, warmup, reps, med, median_of(dev)};
+}
+
+/* discards everything written to it */
+struct null_buf : public std::streambuf {
+  std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+  int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+};
+
+void write_json(std::ostream& os, const std::vector<bench_result>& results, int warmup, int reps, int threads) {
+  os << "{" << std::endl;
+  os << "  \"tool\": \"dprisk-bench\"," << std::endl;
+  os << "  \"warmup\": " << warmup << "," << std::endl;
+  os << "  \"reps\": " << reps << "," << std::endl;
+  os << "  \"threads\": " << threads << "," << std::endl;
+  os << "  \"results\": [" << std::endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    const bench_result& r = results[i];
+    os << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", "
+       << std::setprecision(10)
+       << "\"items\": " << r.items << ", \"warmup\": " << r.warmup << ", \"reps\": " << r.reps << ", "
+       << "\"median_s\": " << r.median << ", \"mad_s\": " << r.mad << ", "
+       << "\"items_per_s\": " << (r.median > 0.0 ? r.items / r.median : 0.0) << "}"
+       << (i + 1 < results.size() ? "," : "") << std::endl;
+  }
+  os << "  ]" << std::endl;
+  os << "}" << std::endl;
+}
+
+int main(int argc, char** argv) {
+
+  int warmup = 1;
+  int reps = 5;
+  int threads = 0;
+  bool quick = false;
+  std::string filter;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string opt = argv[i];
+    if (opt == "--warmup" && i + 1 < argc) {
+      warmup = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+    } else if (opt == "--reps" && i + 1 < argc) {
+      reps = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+    } else if (opt == "--threads" && i + 1 < argc) {
+      threads = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+    } else if (opt == "--quick") {
+      quick = true;
+    } else if (opt == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else {
+      std::cout << "usage: " << argv[0] << " [--warmup W] [--reps R] [--threads T] [--quick] [--filter text]" << std::endl;
+      return 1;
+    }
+  }
+
+  if (warmup < 0 || reps < 1) {
+    std::cout << "requiring: warmup >= 0 and reps >= 1" << std::endl;
+    return 1;
+  }
+  if (threads < 1)
+    threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+  std::vector<bench_result> results;
+  auto wanted = [&](const std::string& name) { return filter.empty() || name.find(filter) != std::string::npos; };
+
+  std::vector<std::vector<int>> dicetuples;
+  std::vector<std::vector<int>> transitions;
+  std::vector<std::vector<double>> probstable;
+
+  // transition tables: the 3v2 tuple enumerates sides^5 rolls
+  const std::vector<int> die_sizes = (quick ? std::vector<int>{6, 8} : std::vector<int>{4, 6, 8, 12, 20});
+  for (int sides : die_sizes) {
+    const std::string name = "transitions.d" + std::to_string(sides);
+    if (!wanted(name))
+      continue;
+    double rolls = 0.0;
+    for (int na = 1; na <= 3; na++)
+      for (int nd = 1; nd <= 2; nd++)
+        rolls += std::pow(static_cast<double>(sides), na + nd);
+    results.push_back(run_bench(name, "rolls", rolls, warmup, reps, [&] {
+      create_prob_table(dicetuples, transitions, probstable, sides, false);
+    }));
+  }
+
+  if (!create_prob_table(dicetuples, transitions, probstable, 6, false)) {
+    std::cout << "prob table computation failed" << std::endl;
+    return 1;
+  }
+
+  // DP solves
+  const std::vector<int> grid_sizes = (quick ? std::vector<int>{100, 300} : std::vector<int>{250, 1000, 2000});
+  for (int n : grid_sizes) {
+    const int A = n, D = n;
+    const double cells = static_cast<double>(A + 1) * (D + 1);
+    const std::string suffix = "." + std::to_string(n);
+    std::vector<double> P;
+    double sink = 0.0;
+
+    if (wanted("solve.passes" + suffix))
+      results.push_back(run_bench("solve.passes" + suffix, "cells", cells, warmup, reps, [&] {
+        solve_passes(A, D, dicetuples, transitions, probstable, P);
+      }));
+    if (wanted("solve.stream" + suffix))
+      results.push_back(run_bench("solve.stream" + suffix, "cells", cells, warmup, reps, [&] {
+        stream_rows(A, D, dicetuples, transitions, probstable,
+                    [&](int a, const double* row) { sink += row[D]; return true; });
+      }));
+    if (wanted("solve.scan" + suffix))
+      results.push_back(run_bench("solve.scan" + suffix, "cells", cells, warmup, reps, [&] {
+        solve_columns_scan(A, D, dicetuples, transitions, probstable, threads,
+                           [&](int d, const double* column) { sink += column[A]; return true; });
+      }));
+
+    auto tiled = [&](const auto& L) {
+      const std::string name = std::string("solve.tiled.") + L.name() + suffix;
+      if (!wanted(name))
+        return;
+      bool allocated = true;
+      const bench_result r = run_bench(name, "cells", cells, warmup, reps, [&] {
+        grid_arena arena;
+        double* Q = (arena.reserve(L.size() * sizeof(double), page_normal) ? arena.allocate_doubles(L.size()) : nullptr);
+        if (Q == nullptr) {
+          allocated = false;
+          return;
+        }
+        first_touch_tiles(L, Q, 64, threads, arena.page_bytes());
+        solve_tiled(L, Q, 64, threads, dicetuples, transitions, probstable);
+        sink += Q[L(A, D)];
+      });
+      if (allocated)
+        results.push_back(r);
+      else
+        std::cerr << name << ": failed to allocate " << L.size() * sizeof(double) << " bytes, skipped" << std::endl;
+    };
+    tiled(layout_d_major(A, D));
+    tiled(layout_a_major(A, D));
+    tiled(layout_skewed(A, D));
+    tiled(layout_morton(A, D));
+
+    if (sink == 12345.0)
+      std::cerr << sink << std::endl;  // keeps the solves from being optimized away
+  }
+
+  // simulators
+  {
+    const int a = 10, d = 10;
+    const int battles = (quick ? 20000 : 50000);
+    const int samples = (quick ? 200000 : 2000000);
+    const int rounds = (quick ? 1000000 : 10000000);
+    int wins = 0;
+    if (wanted("simulate.dice"))
+      results.push_back(run_bench("simulate.dice", "battles", battles, warmup, reps, [&] {
+        for (int i = 0; i < battles; i++)
+          wins += simulate_battle(a, d, 6);
+      }));
+    if (wanted("simulate.rounds")) {
+      // back-to-back battles from (a, d), one count per round of dice
+      std::mt19937_64 gen(1);
+      results.push_back(run_bench("simulate.rounds", "rounds", rounds, warmup, reps, [&] {
+        int x = a, y = d;
+        for (int i = 0; i < rounds; i++) {
+          roll_round(x, y, gen);
+          if (x == 1 || y == 0) {
+            wins += (y == 0);
+            x = a;
+            y = d;
+          }
+        }
+      }));
+    }
+    outcome_sampler S;
+    if (wanted("simulate.alias") && build_outcome_sampler(S, a, a, d, d, dicetuples, transitions, probstable)) {
+      std::mt19937_64 gen(1);
+      results.push_back(run_bench("simulate.alias", "battles", samples, warmup, reps, [&] {
+        int af, df;
+        for (int i = 0; i < samples; i++) {
+          sample_outcome(S, a, d, gen, &af, &df);
+          wins += (df == 0);
+        }
+      }));
+    }
+    if (wins == -1)
+      std::cerr << wins << std::endl;
+  }
+
+  // writers: the rows of a solved table into a stream that discards them
+  {
+    const int n = (quick ? 300 : 1000);
+    std::vector<double> P;
+    solve_passes(n, n, dicetuples, transitions, probstable, P);
+    const output_selection S = full_selection(n, n);
+    const double bytes = static_cast<double>(n + 1) * (n + 1) * sizeof(double);
+    null_buf sink_buf;
+    std::ostream sink(&sink_buf);
+
+    if (wanted("write.binary"))
+      results.push_back(run_bench("write.binary", "bytes", bytes, warmup, reps, [&] {
+        for_each_layout_row(layout_d_major(n, n), P.data(), S,
+                            [&](int a, const double* row) { write_selected_row(sink, row, S, true, 16); });
+      }));
+    if (wanted("write.text"))
+      results.push_back(run_bench("write.text", "cells", bytes / sizeof(double), warmup, reps, [&] {
+        for_each_layout_row(layout_d_major(n, n), P.data(), S,
+                            [&](int a, const double* row) { write_selected_row(sink, row, S, false, 16); });
+      }));
+    if (wanted("write.text.pipeline"))
+      results.push_back(run_bench("write.text.pipeline", "cells", bytes / sizeof(double), warmup, reps, [&] {
+        output_pipeline pipe(sink, S, false, 16, threads, 64);
+        for_each_layout_row(layout_d_major(n, n), P.data(), S,
+                            [&](int a, const double* row) { pipe.push(row); });
+        pipe.finish();
+      }));
+  }
+
+  write_json(std::cout, results, warmup, reps, threads);
+  return 0;
+}
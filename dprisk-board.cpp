@@ -0,0 +1,327 @@
+/*
+ * Monte Carlo simulation of a full attack turn on a territory graph, with
+ * every battle resolved by the outcome sampler from dprisk.cpp (one table
+ * lookup per battle instead of rolling dice round by round). The sampler
+ * covers up to max_sampled_armies units per side; larger battles roll
+ * single rounds until both sides are within that range.
+ *
+ * COMPILE: g++ -Wall -O2 -pthread -o dprisk-board dprisk-board.cpp
+ * USAGE: ./dprisk-board boardfile turns [player] [min_prob] [threads] [seed]
+ *
+ * boardfile = text file with lines
+ *               territory <id> <owner> <armies>
+ *               edge <id> <id>
+ *             ids are 0, 1, 2, ... ; lines starting with # are ignored
+ *             (see dprisk-board-example.txt)
+ * turns     = number of independent turns to simulate
+ * player    = (optional) the player whose turn it is (default 0)
+ * min_prob  = (optional) attack only if P(attacker wins) >= min_prob (default 0.5)
+ * threads   = (optional) number of worker threads (default: hardware concurrency)
+ * seed      = (optional) base seed; thread t uses seed + t (default: random)
+ *
+ * Attack policy: territories of the player are visited in id order (and
+ * every conquered territory is appended to the visit list). From each one,
+ * the adjacent enemy territory with the highest win probability is attacked
+ * as long as that probability is at least min_prob. After a win all but one
+ * of the surviving attackers move into the conquered territory.
+ *
+ * Output (standard output): one line per territory
+ *   id P(owned by player after the turn) E[armies | owned by player]
+ * followed by the distribution of the number of territories the player
+ * holds after the turn, as lines "# count probability".
+ * Throughput is reported on standard error.
+ */
+
+#define DPRISK_NO_MAIN
+#include "dprisk.cpp"
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+
+struct board {
+  std::vector<int> owner;
+  std::vector<int> armies;
+  std::vector<std::vector<int>> adjacent;
+};
+
+bool load_board(const char* filename, board& B) {
+  std::ifstream in(filename);
+  if (!in)
+    return false;
+
+  B.owner.clear();
+  B.armies.clear();
+  B.adjacent.clear();
+
+  std::vector<std::pair<int, int>> edges;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    std::string key;
+    if (!(ls >> key) || key[0] == '#')
+      continue;
+    if (key == "territory") {
+      int id, owner, armies;
+      if (!(ls >> id >> owner >> armies) || id < 0 || armies < 1)
+        return false;
+      if (id >= static_cast<int>(B.owner.size())) {
+        B.owner.resize(id + 1, -1);
+        B.armies.resize(id + 1, 0);
+      }
+      B.owner[id] = owner;
+      B.armies[id] = armies;
+    } else if (key == "edge") {
+      int i, j;
+      if (!(ls >> i >> j))
+        return false;
+      edges.push_back({i, j});
+    } else {
+      return false;
+    }
+  }
+
+  const int n = B.owner.size();
+  for (int i = 0; i < n; i++)
+    if (B.owner[i] < 0)
+      return false;
+
+  B.adjacent.resize(n);
+  for (const auto& e : edges) {
+    if (e.first < 0 || e.first >= n || e.second < 0 || e.second >= n || e.first == e.second)
+      return false;
+    B.adjacent[e.first].push_back(e.second);
+    B.adjacent[e.second].push_back(e.first);
+  }
+  return (n > 0);
+}
+
+/* the sampler tables grow as the cube of the armies covered (about 17 MB for 128) */
+const int max_sampled_armies = 128;
+
+/* battle kernels shared (read-only) by all worker threads */
+struct battle_kernel {
+  int Ma, Md;                 // largest attacker and defender army counts on the board
+  std::vector<double> P;      // P(a, d) = P[a * (Md + 1) + d], 0 <= a <= Ma, 0 <= d <= Md
+  outcome_sampler S;          // region [2..min(Ma, max)] x [1..min(Md, max)]
+};
+
+/*
+  Armies never grow during an attack turn: every battle starts with at
+  most Ma attackers (the largest army of the player) and at most Md
+  defenders (the largest army of the other players).
+*/
+bool build_battle_kernel(battle_kernel& K, int Ma, int Md) {
+  std::vector<std::vector<int>> dicetuples;
+  std::vector<std::vector<int>> transitions;
+  std::vector<std::vector<double>> probstable;
+
+  if (!create_prob_table(dicetuples, transitions, probstable, 6, false))
+    return false;
+
+  K.Ma = Ma;
+  K.Md = Md;
+  K.P.assign((Ma + 1) * (Md + 1), 0.0);
+  stream_rows(Ma, Md, dicetuples, transitions, probstable,
+              [&](int a, const double* row) {
+                std::copy(row, row + Md + 1, K.P.begin() + a * (Md + 1));
+                return true;
+              });
+
+  return build_outcome_sampler(K.S, 2, std::min(Ma, max_sampled_armies), 1, std::min(Md, max_sampled_armies),
+                               dicetuples, transitions, probstable);
+}
+
+/* final state of a battle: single rounds while outside the sampler region, then one sample */
+void resolve_battle(const battle_kernel& K, int a, int d, std::mt19937_64& gen, int* a_final, int* d_final) {
+  while (a > 1 && d > 0 && (a > K.S.a1 || d > K.S.d1))
+    roll_round(a, d, gen);
+  if (a > 1 && d > 0) {
+    sample_outcome(K.S, a, d, gen, a_final, d_final);
+  } else {
+    *a_final = a;
+    *d_final = d;
+  }
+}
+
+/* one attack turn for player on (a copy of) the board; returns the number of battles */
+int simulate_turn(const board& B0,
+                  const battle_kernel& K,
+                  int player,
+                  double min_prob,
+                  std::mt19937_64& gen,
+                  std::vector<int>& owner,
+                  std::vector<int>& armies,
+                  std::vector<int>& visit)
+{
+  owner = B0.owner;
+  armies = B0.armies;
+  visit.clear();
+  for (size_t i = 0; i < owner.size(); i++)
+    if (owner[i] == player)
+      visit.push_back(i);
+
+  int battles = 0;
+  for (size_t v = 0; v < visit.size(); v++) {
+    const int src = visit[v];
+    for (;;) {
+      const int a = armies[src];
+      if (a < 2)
+        break;
+      int best = -1;
+      double best_prob = -1.0;
+      for (int dst : B0.adjacent[src]) {
+        if (owner[dst] == player)
+          continue;
+        const double p = K.P[a * (K.Md + 1) + armies[dst]];
+        if (p > best_prob) {
+          best_prob = p;
+          best = dst;
+        }
+      }
+      if (best < 0 || best_prob < min_prob)
+        break;
+
+      int af, df;
+      resolve_battle(K, a, armies[best], gen, &af, &df);
+      battles += 1;
+      if (df == 0) {
+        owner[best] = player;
+        armies[best] = af - 1;
+        armies[src] = 1;
+        visit.push_back(best);
+      } else {
+        armies[src] = af;
+        armies[best] = df;
+      }
+    }
+  }
+  return battles;
+}
+
+struct turn_stats {
+  std::vector<long long> owned;         // per territory
+  std::vector<double> armies_owned;     // per territory, summed when owned
+  std::vector<long long> count_hist;    // number of territories held
+  long long battles;
+};
+
+void run_turns(const board& B,
+               const battle_kernel& K,
+               int player,
+               double min_prob,
+               long long turns,
+               uint64_t seed,
+               turn_stats& st)
+{
+  const int n = B.owner.size();
+  st.owned.assign(n, 0);
+  st.armies_owned.assign(n, 0.0);
+  st.count_hist.assign(n + 1, 0);
+  st.battles = 0;
+
+  std::mt19937_64 gen(seed);
+  std::vector<int> owner, armies, visit;
+
+  for (long long t = 0; t < turns; t++) {
+    st.battles += simulate_turn(B, K, player, min_prob, gen, owner, armies, visit);
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+      if (owner[i] != player)
+        continue;
+      st.owned[i] += 1;
+      st.armies_owned[i] += armies[i];
+      count += 1;
+    }
+    st.count_hist[count] += 1;
+  }
+}
+
+int main(int argc, char** argv) {
+
+  const int num_text_digits = 8;
+
+  if (argc < 3 || argc > 7) {
+    std::cout << "usage: " << argv[0] << " boardfile turns [player] [min_prob] [threads] [seed]" << std::endl;
+    return 1;
+  }
+
+  board B;
+  if (!load_board(argv[1], B)) {
+    std::cout << "failed to load board: " << argv[1] << std::endl;
+    return 1;
+  }
+
+  const long long turns = std::strtoll(argv[2], nullptr, 0);
+  const int player = (argc > 3 ? static_cast<int>(std::strtol(argv[3], nullptr, 0)) : 0);
+  const double min_prob = (argc > 4 ? std::strtod(argv[4], nullptr) : 0.5);
+  int threads = (argc > 5 ? static_cast<int>(std::strtol(argv[5], nullptr, 0)) : 0);
+  uint64_t seed = (argc > 6 ? std::strtoull(argv[6], nullptr, 0) : std::random_device()());
+
+  if (turns < 1) {
+    std::cout << "requiring: turns >= 1" << std::endl;
+    return 1;
+  }
+
+  if (threads < 1)
+    threads = std::thread::hardware_concurrency();
+  if (threads < 1)
+    threads = 1;
+
+  int Ma = 2, Md = 1;
+  for (size_t i = 0; i < B.owner.size(); i++) {
+    if (B.owner[i] == player)
+      Ma = std::max(Ma, B.armies[i]);
+    else
+      Md = std::max(Md, B.armies[i]);
+  }
+
+  battle_kernel K;
+  if (!build_battle_kernel(K, Ma, Md)) {
+    std::cout << "battle kernel construction failed" << std::endl;
+    return 1;
+  }
+
+  const auto t0 = std::chrono::steady_clock::now();
+
+  std::vector<turn_stats> st(threads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    const long long my_turns = turns / threads + (t < turns % threads ? 1 : 0);
+    workers.emplace_back(run_turns, std::cref(B), std::cref(K), player, min_prob,
+                         my_turns, seed + t, std::ref(st[t]));
+  }
+  for (auto& w : workers)
+    w.join();
+
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  const int n = B.owner.size();
+  turn_stats total = st[0];
+  for (int t = 1; t < threads; t++) {
+    for (int i = 0; i < n; i++) {
+      total.owned[i] += st[t].owned[i];
+      total.armies_owned[i] += st[t].armies_owned[i];
+    }
+    for (int c = 0; c <= n; c++)
+      total.count_hist[c] += st[t].count_hist[c];
+    total.battles += st[t].battles;
+  }
+
+  for (int i = 0; i < n; i++) {
+    std::cout << i << " " << std::setprecision(num_text_digits)
+              << static_cast<double>(total.owned[i]) / turns << " "
+              << (total.owned[i] > 0 ? total.armies_owned[i] / total.owned[i] : 0.0) << std::endl;
+  }
+  for (int c = 0; c <= n; c++) {
+    if (total.count_hist[c] > 0)
+      std::cout << "# " << c << " " << static_cast<double>(total.count_hist[c]) / turns << std::endl;
+  }
+
+  std::cerr << "turns = " << turns << ", battles = " << total.battles
+            << ", threads = " << threads << ", elapsed = " << elapsed << " s"
+            << ", turns/s = " << turns / elapsed << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,454 @@
+/*
+ * Regression checks for dprisk.cpp: every solver and file format is
+ * compared with the passes solver (solve_passes()) or with a round trip
+ * of its own output, on small grids that cover the edge cases (one row,
+ * one column, partial tiles).
+ *
+ * COMPILE: g++ -Wall -O2 -pthread -o dprisk-check dprisk-check.cpp
+ *          (add -g -fsanitize=address,undefined to run them under the sanitizers)
+ * USAGE: ./dprisk-check [--threads T] [--filter text]
+ *
+ * --threads T    threads for the parallel solvers (default 3)
+ * --filter text  run only the checks whose name contains text
+ *
+ * Prints one line per check, "ok" or "FAIL" with what differed, and exits
+ * with status 1 if any check failed.
+ */
+
+#define DPRISK_NO_MAIN
+#include "dprisk.cpp"
+
+struct check_context {
+  int threads = 3;
+  std::vector<std::vector<int>> dicetuples;
+  std::vector<std::vector<int>> transitions;
+  std::vector<std::vector<double>> probstable;
+};
+
+/* the grid shapes every solver is checked on */
+const std::vector<std::pair<int, int>> check_shapes = {{1, 0}, {1, 4}, {2, 1}, {5, 0}, {9, 70}, {130, 3}, {150, 131}};
+
+/* largest |x - y| over P(a, d) of two tables, treating mismatched NaN as infinite */
+template <typename GetX, typename GetY>
+double max_deviation(int A, int D, GetX x, GetY y) {
+  double worst = 0.0;
+  for (int a = 0; a <= A; a++)
+    for (int d = 0; d <= D; d++) {
+      const double u = x(a, d), v = y(a, d);
+      const double dev = (u == v ? 0.0 : std::fabs(u - v));
+      worst = std::max(worst, (std::isnan(dev) ? INFINITY : dev));
+    }
+  return worst;
+}
+
+std::string fmt(double x) {
+  std::ostringstream os;
+  os << std::setprecision(3) << x;
+  return os.str();
+}
+
+/* the reference table, a-major */
+std::vector<double> reference_table(const check_context& ctx, int A, int D) {
+  std::vector<double> P;
+  solve_passes(A, D, ctx.dicetuples, ctx.transitions, ctx.probstable, P);
+  std::vector<double> R(static_cast<size_t>(A + 1) * (D + 1));
+  for (int a = 0; a <= A; a++)
+    for (int d = 0; d <= D; d++)
+      R[static_cast<size_t>(a) * (D + 1) + d] = P[linear_index(a, A, d, D)];
+  return R;
+}
+
+/* stream_rows() gives the same table as the passes solver */
+bool check_stream(const check_context& ctx, std::string& detail) {
+  for (const auto& s : check_shapes) {
+    const int A = s.first, D = s.second;
+    const std::vector<double> R = reference_table(ctx, A, D);
+    std::vector<double> Q(R.size(), -1.0);
+    stream_rows(A, D, ctx.dicetuples, ctx.transitions, ctx.probstable,
+                [&](int a, const double* row) {
+                  std::copy(row, row + D + 1, Q.begin() + static_cast<size_t>(a) * (D + 1));
+                  return true;
+                });
+    if (Q != R) {
+      detail = std::to_string(A) + "x" + std::to_string(D) + " differs";
+      return false;
+    }
+  }
+  return true;
+}
+
+/* a table solved with the transition probabilities of weighted dice */
+std::vector<double> weighted_table(const std::vector<double>& fa, const std::vector<double>& fd, int A, int D,
+                                   const dice_rules& rules = dice_rules()) {
+  check_context w;
+  create_prob_table_weighted(w.dicetuples, w.transitions, w.probstable, nullptr, fa, fd, rules);
+  return reference_table(w, A, D);
+}
+
+/* --sensitivity: P as the passes solver, the derivatives as central differences of P */
+bool check_sensitivity(const check_context& ctx, std::string& detail) {
+  const std::vector<double> fa(6, 1.0 / 6), fd(6, 1.0 / 6);
+  const int K = fa.size() + fd.size();
+  check_context w;
+  std::vector<std::vector<std::vector<double>>> dprobstable;
+  if (!create_prob_table_weighted(w.dicetuples, w.transitions, w.probstable, &dprobstable, fa, fd)) {
+    detail = "weighted prob table failed";
+    return false;
+  }
+
+  auto solve = [&](int A, int D) {
+    std::vector<double> S(static_cast<size_t>(A + 1) * (D + 1) * (K + 1), -1.0);
+    stream_sensitivity_rows(A, D, w.dicetuples, w.transitions, w.probstable, dprobstable,
+                            [&](int a, const double* row) {
+                              std::copy(row, row + (D + 1) * (K + 1), S.begin() + static_cast<size_t>(a) * (D + 1) * (K + 1));
+                              return true;
+                            });
+    return S;
+  };
+
+  for (const auto& s : check_shapes) {
+    const int A = s.first, D = s.second;
+    const std::vector<double> R = reference_table(ctx, A, D);
+    const std::vector<double> S = solve(A, D);
+    const double dev = max_deviation(A, D, [&](int a, int d) { return S[(static_cast<size_t>(a) * (D + 1) + d) * (K + 1)]; },
+                                     [&](int a, int d) { return R[static_cast<size_t>(a) * (D + 1) + d]; });
+    if (!(dev <= 1e-10)) {  // the weighted table rounds differently
+      detail = std::to_string(A) + "x" + std::to_string(D) + ": P deviates by " + fmt(dev);
+      return false;
+    }
+  }
+
+  const int A = 30, D = 25;
+  const double h = 1e-6;
+  const std::vector<double> S = solve(A, D);
+  for (int k = 0; k < K; k++) {
+    std::vector<double> fa_hi = fa, fa_lo = fa, fd_hi = fd, fd_lo = fd;
+    std::vector<double>& hi = (k < 6 ? fa_hi : fd_hi);
+    std::vector<double>& lo = (k < 6 ? fa_lo : fd_lo);
+    hi[k % 6] += h;
+    lo[k % 6] -= h;
+    const std::vector<double> P_hi = weighted_table(fa_hi, fd_hi, A, D);
+    const std::vector<double> P_lo = weighted_table(fa_lo, fd_lo, A, D);
+    const double dev = max_deviation(A, D, [&](int a, int d) { return S[(static_cast<size_t>(a) * (D + 1) + d) * (K + 1) + 1 + k]; },
+                                     [&](int a, int d) {
+                                       const size_t c = static_cast<size_t>(a) * (D + 1) + d;
+                                       return (P_hi[c] - P_lo[c]) / (2 * h);
+                                     });
+    if (!(dev <= 1e-5)) {
+      detail = "dP/dtheta_" + std::to_string(k + 1) + " deviates from the central difference by " + fmt(dev);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* --layout: the tiled solver on every layout, tile size and thread count, read back row by row */
+template <typename Layout>
+bool check_layout(const check_context& ctx, const Layout& L, const std::vector<double>& R, std::string& detail) {
+  const int A = L.A, D = L.D;
+  for (int tile : {2, 7, 64}) {
+    for (int threads : {1, ctx.threads}) {
+      const std::string what = std::string(L.name()) + " " + std::to_string(A) + "x" + std::to_string(D) +
+                               " tile " + std::to_string(tile) + " threads " + std::to_string(threads);
+      grid_arena arena;
+      double* P = (arena.reserve(L.size() * sizeof(double), page_normal) ? arena.allocate_doubles(L.size()) : nullptr);
+      if (P == nullptr) {
+        detail = what + ": allocation failed";
+        return false;
+      }
+      first_touch_tiles(L, P, tile, threads, arena.page_bytes());
+      if (solve_tiled(L, P, tile, threads, ctx.dicetuples, ctx.transitions, ctx.probstable) != A + 1) {
+        detail = what + ": incomplete";
+        return false;
+      }
+      std::vector<double> Q(R.size(), -1.0);
+      for_each_layout_row(L, P, full_selection(A, D),
+                          [&](int a, const double* row) {
+                            std::copy(row, row + D + 1, Q.begin() + static_cast<size_t>(a) * (D + 1));
+                          });
+      if (Q != R) {
+        detail = what + ": differs";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool check_layouts(const check_context& ctx, std::string& detail) {
+  for (const auto& s : check_shapes) {
+    const int A = s.first, D = s.second;
+    const std::vector<double> R = reference_table(ctx, A, D);
+    if (!check_layout(ctx, layout_d_major(A, D), R, detail) || !check_layout(ctx, layout_a_major(A, D), R, detail) ||
+        !check_layout(ctx, layout_skewed(A, D), R, detail) || !check_layout(ctx, layout_morton(A, D), R, detail))
+      return false;
+  }
+  return true;
+}
+
+/* --cell: lattice path sums for every cell of the check shapes */
+bool check_cell(const check_context& ctx, std::string& detail) {
+  double worst = 0.0;
+  for (const auto& s : check_shapes) {
+    const int A = s.first, D = s.second;
+    const std::vector<double> R = reference_table(ctx, A, D);
+    for (int a = 0; a <= A; a++)
+      for (int d = 0; d <= D; d++) {
+        double value = -1.0;
+        if (!direct_cell_probability(a, d, ctx.dicetuples, ctx.transitions, ctx.probstable, &value)) {
+          detail = "no value for (" + std::to_string(a) + ", " + std::to_string(d) + ")";
+          return false;
+        }
+        const double dev = std::fabs(value - R[static_cast<size_t>(a) * (D + 1) + d]);
+        worst = std::max(worst, (std::isnan(dev) ? INFINITY : dev));
+      }
+  }
+  if (!(worst <= 1e-12)) {
+    detail = "deviates by " + fmt(worst);
+    return false;
+  }
+  return true;
+}
+
+/* a scratch file name for the file format checks */
+std::string check_file(const char* what) {
+  return "/tmp/dprisk-check-" + std::to_string(getpid()) + "." + what;
+}
+
+/* --variants: each variant as its own weighted table solve, and the parsing of variant files */
+bool check_variants(const check_context& ctx, std::string& detail) {
+  std::vector<rule_variant> variants;
+  for (const std::vector<int>& v : std::vector<std::vector<int>>{{6, 6, 0, 0}, {8, 6, 0, 0}, {6, 6, 1, 0}, {6, 6, 0, 1}, {4, 10, 2, 1}}) {
+    rule_variant r;
+    r.attacker_sides = v[0];
+    r.defender_sides = v[1];
+    r.rules.defender_bonus = v[2];
+    r.rules.attacker_wins_ties = (v[3] != 0);
+    variants.push_back(r);
+  }
+  const int V = variants.size();
+
+  for (const auto& s : check_shapes) {
+    const int A = s.first, D = s.second;
+    std::vector<double> Q(static_cast<size_t>(A + 1) * (D + 1) * V, -1.0);
+    if (!solve_variants(A, D, variants, ctx.threads,
+                        [&](int a, const double* row) {
+                          std::copy(row, row + (D + 1) * V, Q.begin() + static_cast<size_t>(a) * (D + 1) * V);
+                          return true;
+                        })) {
+      detail = "solve_variants failed";
+      return false;
+    }
+    for (int v = 0; v < V; v++) {
+      const rule_variant& r = variants[v];
+      const std::vector<double> R = weighted_table(std::vector<double>(r.attacker_sides, 1.0 / r.attacker_sides),
+                                                   std::vector<double>(r.defender_sides, 1.0 / r.defender_sides), A, D, r.rules);
+      const double dev = max_deviation(A, D, [&](int a, int d) { return Q[(static_cast<size_t>(a) * (D + 1) + d) * V + v]; },
+                                       [&](int a, int d) { return R[static_cast<size_t>(a) * (D + 1) + d]; });
+      if (dev != 0.0) {
+        detail = std::to_string(A) + "x" + std::to_string(D) + ": variant " + std::to_string(v) + " deviates by " + fmt(dev);
+        return false;
+      }
+    }
+  }
+
+  const std::string file = check_file("variants");
+  auto loads = [&](const char* text) {
+    std::ofstream(file) << text;
+    std::vector<rule_variant> loaded;
+    const bool ok = load_variants(file.c_str(), loaded);
+    std::remove(file.c_str());
+    return ok;
+  };
+  if (!loads("# sa sd bonus ties\n6 6\n8 6 1 1\n")) {
+    detail = "a valid variants file was rejected";
+    return false;
+  }
+  for (const char* bad : {"-3 6\n", "abc 6\n", "6 abc\n", "6 1\n", "6 21\n", "6\n", "# nothing\n"}) {
+    if (loads(bad)) {
+      detail = std::string("accepted the variants line ") + bad;
+      detail.pop_back();
+      return false;
+    }
+  }
+  return true;
+}
+
+/* --container: lossless round trip, single tiles, and truncated or corrupt files rejected */
+bool check_container(const check_context& ctx, std::string& detail) {
+  const std::string file = check_file("container");
+  for (const auto& s : check_shapes) {
+    const int A = s.first, D = s.second;
+    const std::string shape = std::to_string(A) + "x" + std::to_string(D);
+    const std::vector<double> R = reference_table(ctx, A, D);
+    container_info info;
+    std::vector<double> Q;
+    if (!write_container(file.c_str(), A, D, ctx.threads, ctx.dicetuples, ctx.transitions, ctx.probstable) ||
+        !read_container_info(file.c_str(), info) || !read_container(file.c_str(), info, ctx.threads, Q)) {
+      detail = shape + ": round trip failed";
+      break;
+    }
+    if (Q != R) {
+      detail = shape + ": decoded table differs";
+      break;
+    }
+
+    // the last tile alone (partial in both directions)
+    const int T = info.header.tile;
+    const int ta = A / T, td = D / T;
+    const int rows = A + 1 - ta * T, cols = D + 1 - td * T;
+    std::vector<double> tile(static_cast<size_t>(rows) * cols, -1.0);
+    std::ifstream in(file, std::ios::binary);
+    if (!read_container_tile(in, info, ta, td, tile.data(), cols)) {
+      detail = shape + ": reading the last tile failed";
+      break;
+    }
+    for (int r = 0; r < rows && detail.empty(); r++)
+      for (int c = 0; c < cols; c++)
+        if (tile[static_cast<size_t>(r) * cols + c] != R[static_cast<size_t>(ta * T + r) * (D + 1) + td * T + c]) {
+          detail = shape + ": the last tile differs";
+          break;
+        }
+    if (!detail.empty())
+      break;
+  }
+
+  // damaged copies of the last file: truncated, a tile size past the payload, an oversized header
+  std::ifstream in(file, std::ios::binary);
+  const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  container_header h;
+  std::memcpy(&h, bytes.data(), sizeof(h));
+  std::vector<std::string> damaged(3, bytes);
+  damaged[0].resize(bytes.size() - 5);
+  const uint64_t huge = uint64_t(1) << 40;
+  std::memcpy(&damaged[1][h.index_offset + sizeof(uint64_t)], &huge, sizeof(huge));
+  const int32_t big = 2000000000;
+  std::memcpy(&damaged[2][offsetof(container_header, A)], &big, sizeof(big));
+  std::memcpy(&damaged[2][offsetof(container_header, tile)], &big, sizeof(big));
+  for (size_t k = 0; k < damaged.size() && detail.empty(); k++) {
+    std::ofstream(file, std::ios::binary) << damaged[k];
+    container_info info;
+    if (read_container_info(file.c_str(), info))
+      detail = "accepted damaged file " + std::to_string(k);
+  }
+  std::remove(file.c_str());
+  return detail.empty();
+}
+
+/* --checkpoint/--resume: a streamed solve continued from a saved checkpoint, and damaged checkpoints rejected */
+bool check_checkpoint(const check_context& ctx, std::string& detail) {
+  const std::string file = check_file("checkpoint");
+  for (const auto& s : check_shapes) {
+    const int A = s.first, D = s.second;
+    const std::vector<double> R = reference_table(ctx, A, D);
+    for (int k : {2, A / 2 + 1, A}) {
+      if (k < 2 || k > A)
+        continue;
+      const std::string what = std::to_string(A) + "x" + std::to_string(D) + " at row " + std::to_string(k);
+      row_checkpoint C;
+      C.A = A;
+      C.D = D;
+      std::fill(C.selection, C.selection + 6, 0);
+      C.binary = 1;
+      C.probs_fingerprint = probs_fingerprint(ctx.probstable);
+      C.next_a = k;
+      C.output_bytes = static_cast<int64_t>(k) * (D + 1) * sizeof(double);
+      C.row1.assign(R.begin() + static_cast<size_t>(k - 1) * (D + 1), R.begin() + static_cast<size_t>(k) * (D + 1));
+      C.row2.assign(R.begin() + static_cast<size_t>(k - 2) * (D + 1), R.begin() + static_cast<size_t>(k - 1) * (D + 1));
+
+      row_checkpoint L;
+      if (!save_row_checkpoint(file.c_str(), C) || load_row_checkpoint(file.c_str(), A, D, L) != 1) {
+        detail = what + ": save and load failed";
+        break;
+      }
+      if (L.next_a != k || L.output_bytes != C.output_bytes || L.row1 != C.row1 || L.row2 != C.row2) {
+        detail = what + ": loaded checkpoint differs";
+        break;
+      }
+      std::vector<double> Q(R.begin(), R.begin() + static_cast<size_t>(k) * (D + 1));
+      Q.resize(R.size(), -1.0);
+      stream_rows(A, D, ctx.dicetuples, ctx.transitions, ctx.probstable,
+                  [&](int a, const double* row) {
+                    std::copy(row, row + D + 1, Q.begin() + static_cast<size_t>(a) * (D + 1));
+                    return true;
+                  },
+                  L.next_a, L.row1.data(), L.row2.data());
+      if (Q != R) {
+        detail = what + ": resumed table differs";
+        break;
+      }
+      if (load_row_checkpoint(file.c_str(), A + 1, D, L) != -1) {
+        detail = what + ": accepted for another table";
+        break;
+      }
+    }
+    if (!detail.empty())
+      break;
+  }
+
+  // damaged copies of the last checkpoint: a flipped bit, truncated, and an oversized D with a valid checksum
+  std::ifstream in(file, std::ios::binary);
+  const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::vector<std::string> damaged(3, bytes);
+  damaged[0][bytes.size() / 2] ^= 1;
+  damaged[1].resize(bytes.size() - 8);
+  const int32_t big = 0x7fffffff;
+  std::memcpy(&damaged[2][8 + sizeof(int32_t)], &big, sizeof(big));
+  const uint64_t checksum = fnv1a(damaged[2].data(), damaged[2].size() - sizeof(checksum));
+  std::memcpy(&damaged[2][damaged[2].size() - sizeof(checksum)], &checksum, sizeof(checksum));
+  for (size_t k = 0; k < damaged.size() && detail.empty(); k++) {
+    std::ofstream(file, std::ios::binary) << damaged[k];
+    row_checkpoint L;
+    if (load_row_checkpoint(file.c_str(), check_shapes.back().first, check_shapes.back().second, L) != 0)
+      detail = "accepted damaged checkpoint " + std::to_string(k);
+  }
+  std::remove(file.c_str());
+  return detail.empty();
+}
+
+int main(int argc, char** argv) {
+
+  check_context ctx;
+  std::string filter;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string opt = argv[i];
+    if (opt == "--threads" && i + 1 < argc) {
+      ctx.threads = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+    } else if (opt == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else {
+      std::cout << "usage: " << argv[0] << " [--threads T] [--filter text]" << std::endl;
+      return 1;
+    }
+  }
+  ctx.threads = std::max(1, ctx.threads);
+
+  if (!create_prob_table(ctx.dicetuples, ctx.transitions, ctx.probstable, 6, false)) {
+    std::cout << "prob table computation failed" << std::endl;
+    return 1;
+  }
+
+  const std::vector<std::pair<std::string, bool (*)(const check_context&, std::string&)>> checks = {
+    {"stream", check_stream},
+    {"sensitivity", check_sensitivity},
+    {"variants", check_variants},
+    {"cell", check_cell},
+    {"container", check_container},
+    {"layouts", check_layouts},
+    {"checkpoint", check_checkpoint},
+  };
+
+  int failed = 0, run = 0;
+  for (const auto& c : checks) {
+    if (!filter.empty() && c.first.find(filter) == std::string::npos)
+      continue;
+    std::string detail;
+    const bool ok = c.second(ctx, detail);
+    std::cout << c.first << ": " << (ok ? "ok" : "FAIL") << (detail.empty() ? "" : " (" + detail + ")") << std::endl;
+    failed += !ok;
+    run++;
+  }
+  std::cout << run - failed << " of " << run << " checks passed" << std::endl;
+  return (failed == 0 ? 0 : 1);
+}
@@ -1,505 +1,5423 @@
-/*
- * Dynamic programming computation of the (simplified) probability 
- * of winning battles in the board game "Risk" (rules: Hasbro 1963).
- *
- * COMPILE: g++ -Wall -O2 -o dprisk dprisk.cpp
- * USAGE: ./dprisk A D [N] [> tablefilename.txt]
- *
- * A = number of army units for attacker
- * D = number of army units for defender
- * N = (optional) number of simulation samples (to spot-check DP solution)
- *
- * The program computes the probability of attacker winning for the entire
- * [0..A] x [0..D] set of (A + 1) * (D + 1) combinations. The boundary conditions
- * for the array of numbers are: P(A > 0, D = 0) = 1, P(A = 0|1, D > 0) = 0.
- *
- */
-
-#include <iostream>
-#include <iomanip>
-#include <vector>
-#include <algorithm>
-#include <map>
-//#include <chrono>
-#include <random>
-
-/*
-  Let the state of the battle be 
-    (a, d)
-
-  The attacker has "a" army units and defender has "d" units.
-  The transition probabilities for ending up in the below new states are needed.
-    (a - 2, d)
-    (a - 1, d - 1)
-    (a - 1, d) 
-    (a, d - 1) 
-    (a, d - 2)
-
-  These transitions depend on the number of dice that each player throws.
-  The attacker can throw at most min(a - 1, 3) dice, where a >= 1.
-  The defender can throw at most min(d, 2) dice, where d >= 1.
-  If d is equal to 0, the attacker wins. 
-  If a is equal to 1, the defender wins (attacker cannot throw any die).
-  Compare highest die to each other (defender wins any tie). 
-  Then (when applicable) compare next highest die to each other.
-  Here assume every player always uses the maximum number of dice.
-
-  These dice tuples require implementation {attacker, defender}.
-    {1, 1}
-    {2, 1}
-    {3, 1}
-    {1, 2}
-    {2, 2}
-    {3, 2}
-
-  Each transition probability is required for each of the possible dice tuples.
-  This table is precomputed and stored as a 6-vector of 5-vectors.
-*/
-
-int attacker_dice(int a) {
-  int q = (a - 1 < 3 ? a - 1 : 3);
-  return (q < 0 ? 0 : q);
-}
-
-int defender_dice(int d) {
-  int q = (d < 2 ? d : 2);
-  return (q < 0 ? 0 : q);
-}
-
-void sort_three(int a, 
-                int b, 
-                int c, 
-                int* abc)
-{
-  if (a > b) {
-    const int tmp = a;
-    a = b;
-    b = tmp;
-  }
-  if (b > c) {
-    const int tmp = b;
-    b = c;
-    c = tmp;
-  }
-  if (a > b) {
-    const int tmp = a;
-    a = b;
-    b = tmp;
-  }
-  abc[0] = a;
-  abc[1] = b;
-  abc[2] = c;
-}
-
-/* return 1 if attacker wins, otherwise 0 */
-int simulate_battle(int a, int d, int uniform_dice_sides) {
-
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<> distrib(1, uniform_dice_sides);
-
-  std::vector<int> a_dice;
-  std::vector<int> d_dice;
-
-  while (a > 1 && d > 0) {
-
-    a_dice.clear();
-    const int na = attacker_dice(a);
-    for (int i = 0; i < na; i++)
-      a_dice.push_back(distrib(gen));
-
-    d_dice.clear();
-    const int nd = defender_dice(d);
-    for (int i = 0; i < nd; i++)
-      d_dice.push_back(distrib(gen));
-
-    std::sort(a_dice.begin(), a_dice.end(), std::greater<int>());
-    std::sort(d_dice.begin(), d_dice.end(), std::greater<int>());
-
-    const int num_compares = (na > nd ? nd : na);
-
-    for (int i = 0; i < num_compares; i++) {
-      if (a_dice[i] > d_dice[i])
-        d -= 1;
-      else
-        a -= 1;
-    }
-  }
-
-  return (d == 0 ? 1 : 0);
-}
-
-/* brute force precalculation by enumeration of the possible transition probabilities */
-int calc_transitions(const std::vector<std::vector<int>>& order, 
-                     std::vector<int>& counts, 
-                     int na, 
-                     int nd,
-                     int uniform_dice_sides)
-{
-  const int S = uniform_dice_sides;
-  if (S < 2) return 0;
-
-  //std::unordered_map<std::vector<int>, int> M;
-  std::map<std::vector<int>, int> M;
-  for (size_t i = 0; i < order.size(); i++) {
-    std::vector<int> tuple = {order[i][0], order[i][1]};
-    M[tuple] = i;
-  }
-
-  //for (const auto& n : M) {
-  //  std::cout << "(" << n.first[0] << "," << n.first[1] << ") = " << n.second << std::endl;
-  //}
-
-  counts.clear();
-  for (size_t i = 0; i < order.size(); i++)
-    counts.push_back(0);
-
-  int O = 0;
-
-  // Enumerate attacker with i, j, k
-  // Enumerate defender with p, q
-
-  if (na == 1 && nd == 1) {
-    for (int i = 1; i <= S; i++) {
-      for (int p = 1; p <= S; p++) {
-        if (i > p)
-          counts[M[{0, -1}]] += 1;  // attacker wins, defender looses 1 unit
-        if (i <= p)
-          counts[M[{-1, 0}]] += 1;  // defender wins
-        O += 1;
-      }
-    }
-    return O;
-  } 
-
-  if (na == 2 && nd == 1) {
-    for (int i = 1; i <= S; i++) {
-      for (int j = 1; j <= S; j++) {
-        const int ijmax = (i > j ? i : j);
-        for (int p = 1; p <= S; p++) {
-          if (ijmax > p)
-            counts[M[{0, -1}]] += 1;
-          if (ijmax <= p)
-            counts[M[{-1, 0}]] += 1;
-          O += 1;
-        }
-      }
-    }
-    return O;
-  }
-
-  if (na == 3 && nd == 1) {
-    for (int i = 1; i <= S; i++) {
-      for (int j = 1; j <= S; j++) {
-        const int ijmax = (i > j ? i : j);
-        for (int k = 1; k <= S; k++) {
-          const int ijkmax = (k > ijmax ? k : ijmax);
-          for (int p = 1; p <= S; p++) {
-            if (ijkmax > p)
-              counts[M[{0, -1}]] += 1;
-            if (ijkmax <= p)
-              counts[M[{-1, 0}]] += 1;
-            O += 1;
-          }
-        }
-      }
-    }
-    return O;
-  }
-
-  if (na == 1 && nd == 2) {
-    for (int i = 1; i <= S; i++) {
-      for (int p = 1; p <= S; p++) {
-        for (int q = 1; q <= S; q++) {
-          const int pqmax = (p > q ? p : q);
-          if (pqmax >= i)
-            counts[M[{-1, 0}]] += 1;
-          if (pqmax < i)
-            counts[M[{0, -1}]] += 1;
-          O += 1;
-        }
-      }
-    }
-    return O;
-  }
-
-  if (na == 2 && nd == 2) {
-    for (int i = 1; i <= S; i++) {
-      for (int j = 1; j <= S; j++) {
-        const int ijmax = (i > j ? i : j);
-        const int ijmin = (i < j ? i : j);
-        for (int p = 1; p <= S; p++) {
-          for (int q = 1; q <= S; q++) {
-            const int pqmax = (p > q ? p : q);
-            const int pqmin = (p < q ? p : q);
-            if (ijmax > pqmax && ijmin > pqmin)
-              counts[M[{0, -2}]] += 1;
-            if (ijmax <= pqmax && ijmin > pqmin)
-              counts[M[{-1, -1}]] += 1;
-            if (ijmax > pqmax && ijmin <= pqmin)
-              counts[M[{-1, -1}]] += 1;
-            if (ijmax <= pqmax && ijmin <= pqmin)
-              counts[M[{-2, 0}]] += 1;
-            O += 1;
-          }
-        }
-      }
-    }
-    return O;
-  }
-
-  if (na == 3 && nd == 2) {
-    int ijk[3];
-    for (int i = 1; i <= S; i++) {
-      for (int j = 1; j <= S; j++) {
-        const int ijmax = (i > j ? i : j);
-        const int ijmin = (i < j ? i : j);
-        for (int k = 1; k <= S; k++) {
-          const int ijkmax = (k > ijmax ? k : ijmax);
-          const int ijkmin = (k < ijmin ? k : ijmin);
-          sort_three(i, j, k, ijk);
-          if (ijk[0] != ijkmin || ijk[2] != ijkmax)
-            break;
-          const int ijkmid = ijk[1];
-          for (int p = 1; p <= S; p++) {
-            for (int q = 1; q <= S; q++) {
-              const int pqmax = (p > q ? p : q);
-              const int pqmin = (p < q ? p : q);
-              if (ijkmax > pqmax && ijkmid > pqmin)
-                counts[M[{0, -2}]] += 1;
-              if (ijkmax <= pqmax && ijkmid > pqmin)
-                counts[M[{-1, -1}]] += 1;
-              if (ijkmax > pqmax && ijkmid <= pqmin)
-                counts[M[{-1, -1}]] += 1;
-              if (ijkmax <= pqmax && ijkmid <= pqmin)
-                counts[M[{-2, 0}]] += 1;
-              O += 1;
-            }
-          }
-        }
-      }
-    }
-    return O;
-  } 
-
-  return 0;
-}
-
-bool create_prob_table(std::vector<std::vector<int>>& dicetuples,
-                       std::vector<std::vector<int>>& transitions,
-                       std::vector<std::vector<double>>& probstable,
-                       int uniform_dice_sides,
-                       bool verbose = false)
-{
-  dicetuples.clear();
-  transitions.clear();
-  probstable.clear();
-
-  const std::vector<std::vector<int>> T = {{1, 1}, {2, 1}, {3, 1}, {1, 2}, {2, 2}, {3, 2}};
-  dicetuples = T;
-
-  const std::vector<std::vector<int>> P = {{-2, 0}, {-1, -1}, {-1, 0}, {0, -1}, {0, -2}};
-  transitions = P;
-
-  if (verbose) {
-    std::cout << "probs order ";
-    for (size_t q = 0; q < transitions.size(); q++)
-      std::cout << " (" << transitions[q][0] << "," << transitions[q][1] << ")";
-    std::cout << std::endl;
-  }
-
-  for (size_t t = 0; t < dicetuples.size(); t++) {
-    const int na = dicetuples[t][0];
-    const int nd = dicetuples[t][1];
-    std::vector<int> tcounts;
-    int tdenom = calc_transitions(transitions, tcounts, na, nd, uniform_dice_sides);
-    if (tdenom == 0) 
-      return false;
-    probstable.emplace_back();
-    if (verbose)
-      std::cout << "probs (na=" << na << ",nd=" << nd << ") =";
-    int check = 0;
-    for (size_t q = 0; q < transitions.size(); q++) {
-      check += tcounts[q];
-      probstable[t].push_back(static_cast<double>(tcounts[q]) / tdenom);
-      if (verbose)
-        std::cout << " " << probstable[t][probstable[t].size() - 1];
-    }
-    if (verbose)
-      std::cout << std::endl;
-    if (check != tdenom)
-      return false;
-  }
-  return true;
-}
-
-/* 0 <= a <= A, 0 <= d <= D */
-int linear_index(int a, int A, int d, int D) {
-  return (1 + A) * d + a;
-}
-
-int update_elements(int A, 
-                    int D, 
-                    std::vector<double>& P,
-                    double unused_value,
-                    const std::vector<std::vector<int>>& dicetuples,
-                    const std::vector<std::vector<int>>& transitions,
-                    const std::vector<std::vector<double>>& probstable)
-{
-  std::map<std::vector<int>, int> dice_map;
-  for (size_t i = 0; i < dicetuples.size(); i++) {
-    dice_map[{dicetuples[i][0], dicetuples[i][1]}] = i;
-  }
-
-  int num_updated = 0;
-  double* data = P.data();
-
-  for (int a = 1; a <= A; a++) {
-  //for (int a = A; a >= 1; a--) {
-    for (int d = 1; d <= D; d++) {
-      if (data[linear_index(a, A, d, D)] != unused_value)
-        continue;
-
-      const int na = attacker_dice(a);
-      const int nd = defender_dice(d);
-      const int q = dice_map[{na, nd}];
-
-      // Try to compute the value of this element by "backward induction"
-
-      double this_val = 0.0;
-
-      for (size_t i = 0; i < transitions.size(); i++) {
-        const int delta_a = transitions[i][0];
-        const int delta_d = transitions[i][1];
-        const double prob_qi = probstable[q][i];
-
-        if (prob_qi == 0)
-          continue;
-
-        const int idx = linear_index(a + delta_a, A, d + delta_d, D);
-
-        if (data[idx] == unused_value) {
-          this_val = -1.0;
-          break;
-        }
-
-        this_val += prob_qi * data[idx];
-      }
-
-      if (this_val >= 0.0) {
-        data[linear_index(a, A, d, D)] = this_val;
-        num_updated += 1;
-      }
-
-    }
-  }
-  return num_updated;
-}
-
-int main(int argc, char** argv) {
-
-  const int num_text_digits = 16;
-  const int uniform_dice_sides = 6;
-
-  if (argc != 3 && argc != 4) {
-    std::cout << "usage: " << argv[0] << " attackers defenders [samples]" << std::endl;
-    return 1;
-  }
-
-  long int tmp = std::strtol(argv[1], nullptr, 0);
-  int A = static_cast<int>(tmp);
-
-  tmp = std::strtol(argv[2], nullptr, 0);
-  int D = static_cast<int>(tmp);
-
-  int N = 0;
-  if (argc > 3) {
-    tmp = std::strtol(argv[3], nullptr, 0);
-    N = static_cast<int>(tmp);    
-  }
-
-  if (A < 2 || D < 1) {
-    std::cout << "requiring: A >= 2 and D >= 1" << std::endl;
-    return 1;
-  }
-
-  if (N >= 1) {
-    int num_atk_wins = 0;
-    for (int i = 0; i < N; i++) {
-      const int atk_win = simulate_battle(A, D, uniform_dice_sides);
-      num_atk_wins += atk_win;
-    }
-    std::cout << std::setprecision(num_text_digits) << static_cast<double>(num_atk_wins) / N << std::endl;
-    return 0;
-  }
-
-  const double unused_value = -1.0;
-  const int sz = (1 + A) * (1 + D);
-
-  std::vector<double> P(sz, 0.0);
-
-  for (int i = 0; i <= A; i++) {
-    for (int j = 0; j <= D; j++) {
-      int k = linear_index(i, A, j, D);
-      P.data()[k] = unused_value;
-    }
-  }
-
-  // Set boundary conditions
-
-  for (int j = 0; j <= D; j++) {
-    P.data()[linear_index(0, A, j, D)] = 0.0;
-    P.data()[linear_index(1, A, j, D)] = 0.0;
-  }
-
-  for (int i = 2; i <= A; i++) {
-    P.data()[linear_index(i, A, 0, D)] = 1.0;
-  }
-
-  std::vector<std::vector<int>> dicetuples;
-  std::vector<std::vector<int>> transitions;
-  std::vector<std::vector<double>> probstable;
-
-  bool ok = create_prob_table(dicetuples, transitions, probstable, uniform_dice_sides, false);
-
-  if (!ok) {
-    std::cout << "prob table computation failed" << std::endl;
-    return 1;
-  }
-
-  int elems_total = 0;
-  int passes = 0;
-
-  for (;;) {
-    const int elems = update_elements(A, 
-                                      D, 
-                                      P,
-                                      unused_value,
-                                      dicetuples,
-                                      transitions,
-                                      probstable);
-    passes += 1;
-    if (elems == 0)
-      break;
-
-    elems_total += elems;
-  }
-
-  if (elems_total != (A - 1) * D) {
-    std::cout << "DP calculation failed (passes = " << passes << ")" << std::endl;
-    return 1;
-  }
-
-  // finally write results to standard output 
-  // (supposed to be redirected into a file)
-  // rows: 0..A, cols: 0..D
-
-  for (int a = 0; a <= A; a++) {
-    for (int d = 0; d <= D; d++) {
-      std::cout << std::setprecision(num_text_digits) << P.data()[linear_index(a, A, d, D)] << " ";
-    }
-    std::cout << std::endl;
-  }
-
-  return 0;
-}
+/*
+ * Dynamic programming computation of the (simplified) probability 
+ * of winning battles in the board game "Risk" (rules: Hasbro 1963).
+ *
+ * COMPILE: g++ -Wall -O2 -pthread -o dprisk dprisk.cpp
+ * USAGE: ./dprisk A D [N] [options] [> tablefilename.txt]
+ *
+ * A = number of army units for attacker
+ * D = number of army units for defender
+ * N = (optional) number of simulation samples (to spot-check DP solution)
+ *
+ * OPTIONS:
+ * --thresholds p1,p2,...  for each d = 0..D print the smallest a <= A with
+ *                         P(a, d) >= p (one column per level, -1 if none)
+ * --contour               print the 50% contour as polyline vertices "a d"
+ *
+ * --outcomes              with N > 0: draw N final states from the alias table
+ *                         outcome sampler and N from the dice simulation;
+ *                         prints P(attacker wins), E[a final], E[d final] as
+ *                         rows with columns: exact, alias sampler, simulation
+ *
+ * --rounds K              print the battle length distribution instead of P:
+ *                         one line per (a, d) (a-major) with
+ *                         E[R] Var[R] P(R = 0) ... P(R = K) P(R > K)
+ *                         where R is the number of dice rounds
+ * --binary                write raw doubles (native byte order) instead of
+ *                         text: shape (A + 1, D + 1) for the table, and
+ *                         (A + 1, D + 1, K + 4) with --rounds K
+ * --sensitivity           print P and its partial derivatives with respect to
+ *                         each face probability of the attacker die and then
+ *                         of the defender die; one line per (a, d) (a-major),
+ *                         shape (A + 1, D + 1, 1 + Sa + Sd) with --binary
+ * --attacker-die w1,...   weights of the faces of the attacker die (normalized)
+ * --defender-die w1,...   weights of the faces of the defender die (normalized)
+ * --variants file         solve all rule variants listed in file in one pass
+ *                         (lines: attacker_sides defender_sides [defender_bonus]
+ *                         [attacker_wins_ties]); one line per (a, d) with one
+ *                         column per variant, shape (A + 1, D + 1, V) with --binary
+ * --threads T             number of threads (default: hardware concurrency)
+ * --edit q:p0,p1,p2,p3,p4 replace row q of the transition table (dice tuples in
+ *                         the order 1v1, 2v1, 3v1, 1v2, 2v2, 3v2; transitions in
+ *                         the order printed by create_prob_table()) after the
+ *                         solve and update only the cells that depend on it;
+ *                         may be repeated
+ * --engine name           solver for the full table: "passes" (default,
+ *                         repeated sweeps of update_elements()) or "scan"
+ *                         (column by column, each column split across the
+ *                         threads by a parallel scan of the linear recurrence
+ *                         in a; pays off for long columns, A >> D)
+ * --cell                  print only P(A, D), evaluated directly as a sum over
+ *                         lattice paths through the 3v2 regime plus a small
+ *                         boundary table (O(A + D) memory, no table)
+ * --approx L              print P(A, D) and an error estimate: exact (as for
+ *                         --cell, estimate 0) if A + D <= L, otherwise from a
+ *                         normal approximation calibrated against the exact DP
+ * --surface tol           build the compact interpolated lookup surface for
+ *                         [0..A] x [0..D] with certified max error <= tol (if
+ *                         possible within 1 MB) and print: nz nt bytes max_error
+ * --compress eps          build the compressed random access table (64 x 64
+ *                         tiles; constant within eps, or 16-bit codes) from the
+ *                         row stream and print: bytes dense_bytes max_error
+ * --container file        write the table losslessly to a tiled compressed
+ *                         container file (see write_container()), print the
+ *                         container size and the dense size
+ * --decode file           (no A D needed) read a container back and write the
+ *                         table to standard output (text, or --binary)
+ * --rect a0:a1,d0:d1      write only the rectangle [a0..a1] x [d0..d1] of the table
+ * --stride k[,kd]         write only every k-th row (and every kd-th column,
+ *                         default k) of the rectangle
+ * --last-row, --last-col  write only row a = A, or column d = D
+ * --corner                write only P(A, D)
+ *                         (with the default engine a selection streams the rows
+ *                         up to the last selected one instead of storing the table)
+ * --pipeline              overlap the solve with formatting (on --threads
+ *                         threads) and writing (one more thread); same output
+ * --output file           write the output to file instead of standard output,
+ *                         in large buffers with several writes in flight
+ *                         (io_uring on Linux, otherwise pwrite)
+ * --direct                with --output: bypass the page cache (O_DIRECT)
+ * --layout name           solve in tiles (wavefronts of tiles on --threads
+ *                         threads) with the table stored "d-major", "a-major",
+ *                         "skewed" (anti-diagonals) or "morton" (Z-order)
+ * --tile T                tile size for --layout (default 64)
+ * --layout-bench          time the tiled solve and the (binary, discarded)
+ *                         output for each layout; prints lines
+ *                         "layout solve_seconds output_seconds"
+ * --pages mode            memory of the --layout table: "normal" (default),
+ *                         "transparent" or "huge" (explicit) huge pages; the
+ *                         pages are first touched by the solver threads (with
+ *                         "a-major" each by the owner of its tile row)
+ * --page-stats            with --layout: report the page statistics of the
+ *                         table (resident, huge, pages per NUMA node) on stderr
+ * --checkpoint file       with --output: stream the rows of the table (or of
+ *                         the selection) and save a checkpoint to file every
+ *                         --checkpoint-every seconds (default 60)
+ * --resume                with --checkpoint: continue from the checkpoint (if
+ *                         it exists) and append to the output file; the result
+ *                         is identical to an uninterrupted run
+ * --progress S            print "progress: cells done / total, rate, eta" on
+ *                         stderr every S seconds
+ * --deadline S            stop after S seconds and write the rows completed
+ *                         so far (exit status 2 if the table is incomplete)
+ *                         (with --progress or --deadline the table is streamed,
+ *                         or solved in waves with --layout, and SIGINT/SIGTERM
+ *                         stop it the same way; with --checkpoint a checkpoint
+ *                         is saved at the stop; --engine scan solves whole
+ *                         columns, so no row is complete before it finishes)
+ * --stats                 print run statistics as JSON on stderr at exit: time
+ *                         per phase (create_prob_table, boundary_init, solve,
+ *                         output), cells, cells/s (of the solve), passes,
+ *                         threads, peak RSS and bytes written to the output
+ * --stats-file file       the same, written to file
+ * --perf                  with the statistics (implies --stats): hardware
+ *                         counters (cycles, instructions, L1d / LLC misses,
+ *                         branch misses, task clock) per phase, in total and
+ *                         per cell, and with --layout their distribution over
+ *                         the tiles; null for events that cannot be counted
+ * --trace file            write a timeline of the run (phases, solver passes,
+ *                         tiles, scan columns, barrier and queue waits, row
+ *                         formatting, writes) per thread to file in the Chrome
+ *                         trace format (open in chrome://tracing or
+ *                         ui.perfetto.dev); up to 65536 events per thread
+ * --tune                  time short solves of an A x D shaped grid (scaled
+ *                         to about 1M cells) with each engine, layout, tile
+ *                         size and thread count, print lines "engine layout
+ *                         tile threads ns_per_cell" and the best one, and
+ *                         save it to the tuning file
+ * --tune-file file        the tuning file (default .dprisk-tune in the current
+ *                         directory); full table solves without --engine,
+ *                         --layout, --tile, --threads, --progress, --deadline
+ *                         and --pipeline use the saved choice for this machine
+ *                         and grid shape
+ *
+ * The threshold/contour/rounds/sensitivity/variants modes stream the rows of the table and need
+ * O(D) memory only.
+ *
+ * Other programs can reuse the DP and sampling kernels by defining
+ * DPRISK_NO_MAIN before including this file (see dprisk-board.cpp).
+ *
+ * The program computes the probability of attacker winning for the entire
+ * [0..A] x [0..D] set of (A + 1) * (D + 1) combinations. The boundary conditions
+ * for the array of numbers are: P(A > 0, D = 0) = 1, P(A = 0|1, D > 0) = 0.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstdio>
+#include <algorithm>
+#include <map>
+#include <memory>
+//#include <chrono>
+#include <iterator>
+#include <atomic>
+#include <functional>
+#include <csignal>
+#include <random>
+#include <chrono>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#define DPRISK_HAVE_IO_URING
+#define DPRISK_HAVE_PERF_EVENTS
+#endif
+
+/*
+  Let the state of the battle be 
+    (a, d)
+
+  The attacker has "a" army units and defender has "d" units.
+  The transition probabilities for ending up in the below new states are needed.
+    (a - 2, d)
+    (a - 1, d - 1)
+    (a - 1, d) 
+    (a, d - 1) 
+    (a, d - 2)
+
+  These transitions depend on the number of dice that each player throws.
+  The attacker can throw at most min(a - 1, 3) dice, where a >= 1.
+  The defender can throw at most min(d, 2) dice, where d >= 1.
+  If d is equal to 0, the attacker wins. 
+  If a is equal to 1, the defender wins (attacker cannot throw any die).
+  Compare highest die to each other (defender wins any tie). 
+  Then (when applicable) compare next highest die to each other.
+  Here assume every player always uses the maximum number of dice.
+
+  These dice tuples require implementation {attacker, defender}.
+    {1, 1}
+    {2, 1}
+    {3, 1}
+    {1, 2}
+    {2, 2}
+    {3, 2}
+
+  Each transition probability is required for each of the possible dice tuples.
+  This table is precomputed and stored as a 6-vector of 5-vectors.
+*/
+
+int attacker_dice(int a) {
+  int q = (a - 1 < 3 ? a - 1 : 3);
+  return (q < 0 ? 0 : q);
+}
+
+int defender_dice(int d) {
+  int q = (d < 2 ? d : 2);
+  return (q < 0 ? 0 : q);
+}
+
+void sort_three(int a, 
+                int b, 
+                int c, 
+                int* abc)
+{
+  if (a > b) {
+    const int tmp = a;
+    a = b;
+    b = tmp;
+  }
+  if (b > c) {
+    const int tmp = b;
+    b = c;
+    c = tmp;
+  }
+  if (a > b) {
+    const int tmp = a;
+    a = b;
+    b = tmp;
+  }
+  abc[0] = a;
+  abc[1] = b;
+  abc[2] = c;
+}
+
+/* return 1 if attacker wins, otherwise 0 (final state optionally returned) */
+int simulate_battle(int a, 
+                    int d, 
+                    int uniform_dice_sides, 
+                    int* a_final = nullptr, 
+                    int* d_final = nullptr) 
+{
+
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<> distrib(1, uniform_dice_sides);
+
+  std::vector<int> a_dice;
+  std::vector<int> d_dice;
+
+  while (a > 1 && d > 0) {
+
+    a_dice.clear();
+    const int na = attacker_dice(a);
+    for (int i = 0; i < na; i++)
+      a_dice.push_back(distrib(gen));
+
+    d_dice.clear();
+    const int nd = defender_dice(d);
+    for (int i = 0; i < nd; i++)
+      d_dice.push_back(distrib(gen));
+
+    std::sort(a_dice.begin(), a_dice.end(), std::greater<int>());
+    std::sort(d_dice.begin(), d_dice.end(), std::greater<int>());
+
+    const int num_compares = (na > nd ? nd : na);
+
+    for (int i = 0; i < num_compares; i++) {
+      if (a_dice[i] > d_dice[i])
+        d -= 1;
+      else
+        a -= 1;
+    }
+  }
+
+  if (a_final != nullptr) *a_final = a;
+  if (d_final != nullptr) *d_final = d;
+
+  return (d == 0 ? 1 : 0);
+}
+
+/* one round of dice with the caller's generator (a > 1, d > 0) */
+void roll_round(int& a, int& d, std::mt19937_64& gen, int uniform_dice_sides = 6) {
+  std::uniform_int_distribution<int> die(1, uniform_dice_sides);
+  int a_dice[3], d_dice[2];
+  const int na = attacker_dice(a);
+  const int nd = defender_dice(d);
+  for (int i = 0; i < na; i++)
+    a_dice[i] = die(gen);
+  for (int i = 0; i < nd; i++)
+    d_dice[i] = die(gen);
+  std::sort(a_dice, a_dice + na, std::greater<int>());
+  std::sort(d_dice, d_dice + nd, std::greater<int>());
+  const int num_compares = (na > nd ? nd : na);
+  for (int i = 0; i < num_compares; i++) {
+    if (a_dice[i] > d_dice[i])
+      d -= 1;
+    else
+      a -= 1;
+  }
+}
+
+/* brute force precalculation by enumeration of the possible transition probabilities */
+int calc_transitions(const std::vector<std::vector<int>>& order, 
+                     std::vector<int>& counts, 
+                     int na, 
+                     int nd,
+                     int uniform_dice_sides)
+{
+  const int S = uniform_dice_sides;
+  if (S < 2) return 0;
+
+  //std::unordered_map<std::vector<int>, int> M;
+  std::map<std::vector<int>, int> M;
+  for (size_t i = 0; i < order.size(); i++) {
+    std::vector<int> tuple = {order[i][0], order[i][1]};
+    M[tuple] = i;
+  }
+
+  //for (const auto& n : M) {
+  //  std::cout << "(" << n.first[0] << "," << n.first[1] << ") = " << n.second << std::endl;
+  //}
+
+  counts.clear();
+  for (size_t i = 0; i < order.size(); i++)
+    counts.push_back(0);
+
+  int O = 0;
+
+  // Enumerate attacker with i, j, k
+  // Enumerate defender with p, q
+
+  if (na == 1 && nd == 1) {
+    for (int i = 1; i <= S; i++) {
+      for (int p = 1; p <= S; p++) {
+        if (i > p)
+          counts[M[{0, -1}]] += 1;  // attacker wins, defender looses 1 unit
+        if (i <= p)
+          counts[M[{-1, 0}]] += 1;  // defender wins
+        O += 1;
+      }
+    }
+    return O;
+  } 
+
+  if (na == 2 && nd == 1) {
+    for (int i = 1; i <= S; i++) {
+      for (int j = 1; j <= S; j++) {
+        const int ijmax = (i > j ? i : j);
+        for (int p = 1; p <= S; p++) {
+          if (ijmax > p)
+            counts[M[{0, -1}]] += 1;
+          if (ijmax <= p)
+            counts[M[{-1, 0}]] += 1;
+          O += 1;
+        }
+      }
+    }
+    return O;
+  }
+
+  if (na == 3 && nd == 1) {
+    for (int i = 1; i <= S; i++) {
+      for (int j = 1; j <= S; j++) {
+        const int ijmax = (i > j ? i : j);
+        for (int k = 1; k <= S; k++) {
+          const int ijkmax = (k > ijmax ? k : ijmax);
+          for (int p = 1; p <= S; p++) {
+            if (ijkmax > p)
+              counts[M[{0, -1}]] += 1;
+            if (ijkmax <= p)
+              counts[M[{-1, 0}]] += 1;
+            O += 1;
+          }
+        }
+      }
+    }
+    return O;
+  }
+
+  if (na == 1 && nd == 2) {
+    for (int i = 1; i <= S; i++) {
+      for (int p = 1; p <= S; p++) {
+        for (int q = 1; q <= S; q++) {
+          const int pqmax = (p > q ? p : q);
+          if (pqmax >= i)
+            counts[M[{-1, 0}]] += 1;
+          if (pqmax < i)
+            counts[M[{0, -1}]] += 1;
+          O += 1;
+        }
+      }
+    }
+    return O;
+  }
+
+  if (na == 2 && nd == 2) {
+    for (int i = 1; i <= S; i++) {
+      for (int j = 1; j <= S; j++) {
+        const int ijmax = (i > j ? i : j);
+        const int ijmin = (i < j ? i : j);
+        for (int p = 1; p <= S; p++) {
+          for (int q = 1; q <= S; q++) {
+            const int pqmax = (p > q ? p : q);
+            const int pqmin = (p < q ? p : q);
+            if (ijmax > pqmax && ijmin > pqmin)
+              counts[M[{0, -2}]] += 1;
+            if (ijmax <= pqmax && ijmin > pqmin)
+              counts[M[{-1, -1}]] += 1;
+            if (ijmax > pqmax && ijmin <= pqmin)
+              counts[M[{-1, -1}]] += 1;
+            if (ijmax <= pqmax && ijmin <= pqmin)
+              counts[M[{-2, 0}]] += 1;
+            O += 1;
+          }
+        }
+      }
+    }
+    return O;
+  }
+
+  if (na == 3 && nd == 2) {
+    int ijk[3];
+    for (int i = 1; i <= S; i++) {
+      for (int j = 1; j <= S; j++) {
+        const int ijmax = (i > j ? i : j);
+        const int ijmin = (i < j ? i : j);
+        for (int k = 1; k <= S; k++) {
+          const int ijkmax = (k > ijmax ? k : ijmax);
+          const int ijkmin = (k < ijmin ? k : ijmin);
+          sort_three(i, j, k, ijk);
+          if (ijk[0] != ijkmin || ijk[2] != ijkmax)
+            break;
+          const int ijkmid = ijk[1];
+          for (int p = 1; p <= S; p++) {
+            for (int q = 1; q <= S; q++) {
+              const int pqmax = (p > q ? p : q);
+              const int pqmin = (p < q ? p : q);
+              if (ijkmax > pqmax && ijkmid > pqmin)
+                counts[M[{0, -2}]] += 1;
+              if (ijkmax <= pqmax && ijkmid > pqmin)
+                counts[M[{-1, -1}]] += 1;
+              if (ijkmax > pqmax && ijkmid <= pqmin)
+                counts[M[{-1, -1}]] += 1;
+              if (ijkmax <= pqmax && ijkmid <= pqmin)
+                counts[M[{-2, 0}]] += 1;
+              O += 1;
+            }
+          }
+        }
+      }
+    }
+    return O;
+  } 
+
+  return 0;
+}
+
+bool create_prob_table(std::vector<std::vector<int>>& dicetuples,
+                       std::vector<std::vector<int>>& transitions,
+                       std::vector<std::vector<double>>& probstable,
+                       int uniform_dice_sides,
+                       bool verbose = false)
+{
+  dicetuples.clear();
+  transitions.clear();
+  probstable.clear();
+
+  const std::vector<std::vector<int>> T = {{1, 1}, {2, 1}, {3, 1}, {1, 2}, {2, 2}, {3, 2}};
+  dicetuples = T;
+
+  const std::vector<std::vector<int>> P = {{-2, 0}, {-1, -1}, {-1, 0}, {0, -1}, {0, -2}};
+  transitions = P;
+
+  if (verbose) {
+    std::cout << "probs order ";
+    for (size_t q = 0; q < transitions.size(); q++)
+      std::cout << " (" << transitions[q][0] << "," << transitions[q][1] << ")";
+    std::cout << std::endl;
+  }
+
+  for (size_t t = 0; t < dicetuples.size(); t++) {
+    const int na = dicetuples[t][0];
+    const int nd = dicetuples[t][1];
+    std::vector<int> tcounts;
+    int tdenom = calc_transitions(transitions, tcounts, na, nd, uniform_dice_sides);
+    if (tdenom == 0) 
+      return false;
+    probstable.emplace_back();
+    if (verbose)
+      std::cout << "probs (na=" << na << ",nd=" << nd << ") =";
+    int check = 0;
+    for (size_t q = 0; q < transitions.size(); q++) {
+      check += tcounts[q];
+      probstable[t].push_back(static_cast<double>(tcounts[q]) / tdenom);
+      if (verbose)
+        std::cout << " " << probstable[t][probstable[t].size() - 1];
+    }
+    if (verbose)
+      std::cout << std::endl;
+    if (check != tdenom)
+      return false;
+  }
+  return true;
+}
+
+/*
+  Weighted dice version of calc_transitions(): face f (1-based) of the
+  attacker die shows up with probability fa[f - 1], and likewise fd for the
+  defender. All ordered dice outcomes are enumerated. Besides the
+  probabilities of the transitions (in the given order) the partial
+  derivatives with respect to every face probability are returned:
+    grads[q][k]      = d probs[q] / d fa[k],         0 <= k < fa.size()
+    grads[q][Sa + k] = d probs[q] / d fd[k],         0 <= k < fd.size()
+  (skipped if grads is null). The face probabilities are treated as independent parameters (no
+  renormalization), so directional derivatives along any perturbation of
+  the dice follow by linear combination.
+
+  Rule variants: defender_bonus is added to every defender die before the
+  comparison, and ties go to the attacker if attacker_wins_ties is set.
+*/
+struct dice_rules {
+  int defender_bonus = 0;
+  bool attacker_wins_ties = false;
+};
+
+bool calc_transitions_weighted(const std::vector<std::vector<int>>& order,
+                               std::vector<double>& probs,
+                               std::vector<std::vector<double>>* grads,
+                               int na,
+                               int nd,
+                               const std::vector<double>& fa,
+                               const std::vector<double>& fd,
+                               const dice_rules& rules = dice_rules())
+{
+  const int Sa = fa.size();
+  const int Sd = fd.size();
+  const int n = na + nd;
+  if (Sa < 2 || Sd < 2 || na < 1 || nd < 1 || na > 3 || nd > 2)
+    return false;
+
+  // index of the transition (-loss_a, -loss_d)
+  int M[3][3];
+  for (int la = 0; la < 3; la++)
+    for (int ld = 0; ld < 3; ld++)
+      M[la][ld] = -1;
+  for (size_t i = 0; i < order.size(); i++)
+    if (order[i][0] <= 0 && order[i][0] > -3 && order[i][1] <= 0 && order[i][1] > -3)
+      M[-order[i][0]][-order[i][1]] = i;
+
+  probs.assign(order.size(), 0.0);
+  if (grads != nullptr)
+    grads->assign(order.size(), std::vector<double>(Sa + Sd, 0.0));
+
+  // faces[0..na) attacker dice, faces[na..n) defender dice (0-based faces)
+  int faces[5] = {0, 0, 0, 0, 0};
+  for (;;) {
+    double w[5];
+    for (int j = 0; j < n; j++)
+      w[j] = (j < na ? fa[faces[j]] : fd[faces[j]]);
+
+    int adice[3], ddice[2];
+    for (int j = 0; j < na; j++) adice[j] = faces[j];
+    for (int j = 0; j < nd; j++) ddice[j] = faces[na + j];
+    std::sort(adice, adice + na, std::greater<int>());
+    std::sort(ddice, ddice + nd, std::greater<int>());
+
+    int loss_a = 0, loss_d = 0;
+    for (int j = 0; j < std::min(na, nd); j++) {
+      const int dval = ddice[j] + rules.defender_bonus;
+      if (adice[j] > dval || (adice[j] == dval && rules.attacker_wins_ties))
+        loss_d += 1;
+      else
+        loss_a += 1;
+    }
+    const int q = M[loss_a][loss_d];
+    if (q < 0)
+      return false;
+
+    double weight = 1.0;
+    for (int j = 0; j < n; j++)
+      weight *= w[j];
+    probs[q] += weight;
+
+    // product rule, one die at a time (no division, so zero faces are fine)
+    for (int j = 0; grads != nullptr && j < n; j++) {
+      double others = 1.0;
+      for (int m = 0; m < n; m++)
+        if (m != j) others *= w[m];
+      (*grads)[q][j < na ? faces[j] : Sa + faces[j]] += others;
+    }
+
+    int j = 0;
+    while (j < n) {
+      faces[j] += 1;
+      if (faces[j] < (j < na ? Sa : Sd))
+        break;
+      faces[j] = 0;
+      j++;
+    }
+    if (j == n)
+      break;
+  }
+  return true;
+}
+
+/*
+  Same as create_prob_table() but for weighted dice, and also returning the
+  derivative table dprobstable[t][q][k] = d probstable[t][q] / d theta_k where
+  theta = (fa, fd) as in calc_transitions_weighted() (unless dprobstable is null).
+*/
+bool create_prob_table_weighted(std::vector<std::vector<int>>& dicetuples,
+                                std::vector<std::vector<int>>& transitions,
+                                std::vector<std::vector<double>>& probstable,
+                                std::vector<std::vector<std::vector<double>>>* dprobstable,
+                                const std::vector<double>& fa,
+                                const std::vector<double>& fd,
+                                const dice_rules& rules = dice_rules())
+{
+  dicetuples = {{1, 1}, {2, 1}, {3, 1}, {1, 2}, {2, 2}, {3, 2}};
+  transitions = {{-2, 0}, {-1, -1}, {-1, 0}, {0, -1}, {0, -2}};
+  probstable.clear();
+  if (dprobstable != nullptr)
+    dprobstable->clear();
+
+  for (size_t t = 0; t < dicetuples.size(); t++) {
+    std::vector<double> probs;
+    std::vector<std::vector<double>> grads;
+    if (!calc_transitions_weighted(transitions, probs, (dprobstable != nullptr ? &grads : nullptr), 
+                                   dicetuples[t][0], dicetuples[t][1], fa, fd, rules))
+      return false;
+    probstable.push_back(probs);
+    if (dprobstable != nullptr)
+      dprobstable->push_back(grads);
+  }
+  return true;
+}
+
+/* 0 <= a <= A, 0 <= d <= D */
+int linear_index(int a, int A, int d, int D) {
+  return (1 + A) * d + a;
+}
+
+int update_elements(int A, 
+                    int D, 
+                    std::vector<double>& P,
+                    double unused_value,
+                    const std::vector<std::vector<int>>& dicetuples,
+                    const std::vector<std::vector<int>>& transitions,
+                    const std::vector<std::vector<double>>& probstable)
+{
+  std::map<std::vector<int>, int> dice_map;
+  for (size_t i = 0; i < dicetuples.size(); i++) {
+    dice_map[{dicetuples[i][0], dicetuples[i][1]}] = i;
+  }
+
+  int num_updated = 0;
+  double* data = P.data();
+
+  for (int a = 1; a <= A; a++) {
+  //for (int a = A; a >= 1; a--) {
+    for (int d = 1; d <= D; d++) {
+      if (data[linear_index(a, A, d, D)] != unused_value)
+        continue;
+
+      const int na = attacker_dice(a);
+      const int nd = defender_dice(d);
+      const int q = dice_map[{na, nd}];
+
+      // Try to compute the value of this element by "backward induction"
+
+      double this_val = 0.0;
+
+      for (size_t i = 0; i < transitions.size(); i++) {
+        const int delta_a = transitions[i][0];
+        const int delta_d = transitions[i][1];
+        const double prob_qi = probstable[q][i];
+
+        if (prob_qi == 0)
+          continue;
+
+        const int idx = linear_index(a + delta_a, A, d + delta_d, D);
+
+        if (data[idx] == unused_value) {
+          this_val = -1.0;
+          break;
+        }
+
+        this_val += prob_qi * data[idx];
+      }
+
+      if (this_val >= 0.0) {
+        data[linear_index(a, A, d, D)] = this_val;
+        num_updated += 1;
+      }
+
+    }
+  }
+  return num_updated;
+}
+
+/* dense replacement for the dice_map lookup: dice_index[na][nd] = row of probstable */
+void fill_dice_index(const std::vector<std::vector<int>>& dicetuples, int dice_index[4][3]) {
+  for (int na = 0; na < 4; na++)
+    for (int nd = 0; nd < 3; nd++)
+      dice_index[na][nd] = -1;
+  for (size_t i = 0; i < dicetuples.size(); i++)
+    dice_index[dicetuples[i][0]][dicetuples[i][1]] = i;
+}
+
+/*
+  Row streaming version of the same DP. The stencil only reaches back to
+  rows a - 1 and a - 2, so visiting a = 0, 1, ..., A in order and keeping
+  three rows of length D + 1 is enough; memory is O(D) instead of O(A * D).
+  Every finished row P(a, 0..D) is passed to on_row(a, row); the sweep stops
+  early if the callback returns false. The per-element sum is evaluated in
+  the same order as in update_elements(), so the values are bit-identical.
+  A sweep can be resumed at row a_start > 0 from the two previous rows
+  (prev1 = row a_start - 1, prev2 = row a_start - 2, unused if negative).
+*/
+template <typename RowFunc>
+bool stream_rows(int A,
+                 int D,
+                 const std::vector<std::vector<int>>& dicetuples,
+                 const std::vector<std::vector<int>>& transitions,
+                 const std::vector<std::vector<double>>& probstable,
+                 RowFunc on_row,
+                 int a_start = 0,
+                 const double* prev1 = nullptr,
+                 const double* prev2 = nullptr)
+{
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+
+  const int W = D + 1;
+  std::vector<double> rows(3 * W, 0.0);
+
+  if (a_start >= 1 && prev1 != nullptr)
+    std::copy(prev1, prev1 + W, rows.begin() + ((a_start - 1) % 3) * W);
+  if (a_start >= 2 && prev2 != nullptr)
+    std::copy(prev2, prev2 + W, rows.begin() + ((a_start - 2) % 3) * W);
+
+  for (int a = a_start; a <= A; a++) {
+    double* cur = rows.data() + (a % 3) * W;
+    const double* src[3] = {cur,                                 // row a
+                            rows.data() + ((a + 2) % 3) * W,     // row a - 1
+                            rows.data() + ((a + 1) % 3) * W};    // row a - 2
+
+    if (a < 2) {
+      for (int d = 0; d <= D; d++)
+        cur[d] = 0.0;
+    } else {
+      cur[0] = 1.0;
+      const int na = attacker_dice(a);
+      for (int d = 1; d <= D; d++) {
+        const int q = dice_index[na][defender_dice(d)];
+        double this_val = 0.0;
+        for (size_t i = 0; i < transitions.size(); i++) {
+          const double prob_qi = probstable[q][i];
+          if (prob_qi == 0)
+            continue;
+          this_val += prob_qi * src[-transitions[i][0]][d + transitions[i][1]];
+        }
+        cur[d] = this_val;
+      }
+    }
+
+    if (!on_row(a, static_cast<const double*>(cur)))
+      return false;
+  }
+  return true;
+}
+
+/*
+  Inverse lookups accumulated from streamed rows: for each probability
+  level p and each defender count d, the smallest a <= A with P(a, d) >= p
+  (or -1 if there is none), and the 50% contour as a polyline of
+  (a, d) vertices where a is linearly interpolated between the two rows
+  that straddle 0.5. P(a, d) is nondecreasing in a, so the sweep can stop
+  once every threshold has been found.
+*/
+struct threshold_tables {
+  std::vector<double> levels;
+  std::vector<std::vector<int>> min_attackers;  // [level][d]
+  std::vector<double> contour_a;                // [d], negative if not reached
+  std::vector<double> last_row;
+  int num_missing;
+};
+
+void init_thresholds(threshold_tables& T, const std::vector<double>& levels, int D) {
+  T.levels = levels;
+  T.min_attackers.assign(levels.size(), std::vector<int>(D + 1, -1));
+  T.contour_a.assign(D + 1, -1.0);
+  T.last_row.assign(D + 1, 0.0);
+  T.num_missing = (levels.size() + 1) * (D + 1);
+}
+
+/* returns false when nothing is left to find */
+bool update_thresholds(threshold_tables& T, int a, const double* row, int D) {
+  for (size_t k = 0; k < T.levels.size(); k++) {
+    int* amin = T.min_attackers[k].data();
+    for (int d = 0; d <= D; d++) {
+      if (amin[d] < 0 && row[d] >= T.levels[k]) {
+        amin[d] = a;
+        T.num_missing -= 1;
+      }
+    }
+  }
+  for (int d = 0; d <= D; d++) {
+    if (T.contour_a[d] < 0.0 && row[d] >= 0.5) {
+      const double p0 = T.last_row[d];
+      T.contour_a[d] = (a == 0 ? 0.0 : (a - 1) + (0.5 - p0) / (row[d] - p0));
+      T.num_missing -= 1;
+    }
+    T.last_row[d] = row[d];
+  }
+  return (T.num_missing > 0);
+}
+
+/*
+  Distribution of the final (absorbing) state of a battle started at (a, d),
+  obtained by pushing the probability mass forward through the transitions.
+  Cells are visited with a and d decreasing, so all mass has arrived at a
+  cell before it is passed on. Cost is O(a * d) per start.
+
+  Outcome k (0 <= k < a - 1 + d) is the final state
+    k <  a - 1 : (k + 2, 0)           attacker wins with k + 2 units left
+    k >= a - 1 : (1, k - a + 2)       defender wins with k - a + 2 units left
+*/
+bool outcome_distribution(int a,
+                          int d,
+                          const std::vector<std::vector<int>>& dicetuples,
+                          const std::vector<std::vector<int>>& transitions,
+                          const std::vector<std::vector<double>>& probstable,
+                          std::vector<double>& dist)
+{
+  dist.clear();
+  if (a < 2 || d < 1)
+    return false;
+
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+
+  const int W = d + 1;
+  std::vector<double> mass((a + 1) * W, 0.0);
+  mass[a * W + d] = 1.0;
+
+  for (int x = a; x >= 2; x--) {
+    const int na = attacker_dice(x);
+    for (int y = d; y >= 1; y--) {
+      const double m = mass[x * W + y];
+      if (m == 0.0)
+        continue;
+      const int q = dice_index[na][defender_dice(y)];
+      for (size_t i = 0; i < transitions.size(); i++) {
+        const double prob_qi = probstable[q][i];
+        if (prob_qi == 0)
+          continue;
+        mass[(x + transitions[i][0]) * W + y + transitions[i][1]] += prob_qi * m;
+      }
+    }
+  }
+
+  dist.resize(a - 1 + d);
+  for (int x = 2; x <= a; x++)
+    dist[x - 2] = mass[x * W + 0];
+  for (int y = 1; y <= d; y++)
+    dist[a - 2 + y] = mass[1 * W + y];
+  return true;
+}
+
+/*
+  Constant time sampler of battle outcomes. For every start (a, d) in the
+  region [a0..a1] x [d0..d1] the outcome distribution is stored as a Walker
+  alias table: column k is kept with probability cutoff[k] / 2^32, and
+  otherwise replaced by alias[k]. One 64-bit random number selects both the
+  column (high half) and the coin (low half). The tables are read-only once
+  built, so any number of threads can sample concurrently as long as each
+  one uses its own generator.
+*/
+struct outcome_sampler {
+  int a0, a1, d0, d1;
+  std::vector<size_t> offset;     // per start cell, (a - a0) * (d1 - d0 + 1) + (d - d0)
+  std::vector<uint32_t> cutoff;
+  std::vector<uint32_t> alias;
+};
+
+void build_alias_table(const std::vector<double>& dist, uint32_t* cutoff, uint32_t* alias) {
+  const int n = dist.size();
+  std::vector<double> scaled(n);
+  std::vector<int> small, large;
+  double total = 0.0;
+  for (int k = 0; k < n; k++)
+    total += dist[k];
+  for (int k = 0; k < n; k++) {
+    scaled[k] = dist[k] * n / total;
+    if (scaled[k] < 1.0)
+      small.push_back(k);
+    else
+      large.push_back(k);
+  }
+
+  const double two32 = 4294967296.0;
+  while (!small.empty() && !large.empty()) {
+    const int s = small.back(); small.pop_back();
+    const int l = large.back();
+    cutoff[s] = static_cast<uint32_t>(scaled[s] * two32);
+    alias[s] = l;
+    scaled[l] -= 1.0 - scaled[s];
+    if (scaled[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // leftovers are 1 up to roundoff
+  for (int k : large) { cutoff[k] = 0xffffffffu; alias[k] = k; }
+  for (int k : small) { cutoff[k] = 0xffffffffu; alias[k] = k; }
+}
+
+/*
+  The tables for all starts come from one backward pass per final state f:
+  the probability Q_f(a, d) of ending in f from (a, d) satisfies the same
+  recurrence as P, with Q_f = 1 at f and 0 at the other terminal cells.
+  That is O((a1 + d1) * a1 * d1) in total instead of one forward pass per
+  start (outcome_distribution(), O(a1^2 * d1^2)). Memory is one double per
+  table entry while building.
+*/
+bool build_outcome_sampler(outcome_sampler& S,
+                           int a0, int a1, int d0, int d1,
+                           const std::vector<std::vector<int>>& dicetuples,
+                           const std::vector<std::vector<int>>& transitions,
+                           const std::vector<std::vector<double>>& probstable)
+{
+  if (a0 < 2 || d0 < 1 || a1 < a0 || d1 < d0)
+    return false;
+
+  S.a0 = a0; S.a1 = a1; S.d0 = d0; S.d1 = d1;
+  S.offset.clear();
+  S.offset.push_back(0);
+  for (int a = a0; a <= a1; a++)
+    for (int d = d0; d <= d1; d++)
+      S.offset.push_back(S.offset.back() + (a - 1 + d));
+
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+
+  // dist[offset[c] + k] = probability of outcome k from start c
+  std::vector<double> dist(S.offset.back(), 0.0);
+  const int W = d1 + 1;
+  std::vector<double> Q(static_cast<size_t>(a1 + 1) * W);
+  const int cols = d1 - d0 + 1;
+
+  // final states (x, 0) for x = 2..a1, then (1, y) for y = 1..d1
+  for (int f = 0; f < a1 - 1 + d1; f++) {
+    const int fx = (f < a1 - 1 ? f + 2 : 1);
+    const int fy = (f < a1 - 1 ? 0 : f - a1 + 2);
+    std::fill(Q.begin(), Q.end(), 0.0);
+    Q[static_cast<size_t>(fx) * W + fy] = 1.0;
+    // no start with fewer units than f reaches it
+    for (int a = std::max(2, fx); a <= a1; a++) {
+      const int na = attacker_dice(a);
+      for (int d = std::max(1, fy); d <= d1; d++) {
+        const double* prob_q = probstable[dice_index[na][defender_dice(d)]].data();
+        double this_val = 0.0;
+        for (size_t i = 0; i < transitions.size(); i++) {
+          if (prob_q[i] == 0)
+            continue;
+          const int y = d + transitions[i][1];
+          if (y >= fy)
+            this_val += prob_q[i] * Q[static_cast<size_t>(a + transitions[i][0]) * W + y];
+        }
+        Q[static_cast<size_t>(a) * W + d] = this_val;
+        if (a >= a0 && d >= d0) {
+          // outcome index of f for start (a, d) (see outcome_distribution())
+          const size_t c = static_cast<size_t>(a - a0) * cols + (d - d0);
+          if (fy == 0)
+            dist[S.offset[c] + fx - 2] = this_val;
+          else
+            dist[S.offset[c] + a - 2 + fy] = this_val;
+        }
+      }
+    }
+  }
+
+  S.cutoff.assign(S.offset.back(), 0);
+  S.alias.assign(S.offset.back(), 0);
+  std::vector<double> start_dist;
+  for (size_t c = 0; c + 1 < S.offset.size(); c++) {
+    start_dist.assign(dist.begin() + S.offset[c], dist.begin() + S.offset[c + 1]);
+    build_alias_table(start_dist, S.cutoff.data() + S.offset[c], S.alias.data() + S.offset[c]);
+  }
+  return true;
+}
+
+/* draw one final state for the start (a, d), which must lie in the sampler region */
+inline void sample_outcome(const outcome_sampler& S, 
+                           int a, 
+                           int d, 
+                           std::mt19937_64& gen, 
+                           int* a_final, 
+                           int* d_final) 
+{
+  const size_t c = static_cast<size_t>(a - S.a0) * (S.d1 - S.d0 + 1) + (d - S.d0);
+  const size_t base = S.offset[c];
+  const uint64_t n = S.offset[c + 1] - base;
+  const uint64_t r = gen();
+  uint32_t k = static_cast<uint32_t>(((r >> 32) * n) >> 32);
+  if (static_cast<uint32_t>(r) >= S.cutoff[base + k])
+    k = S.alias[base + k];
+  if (static_cast<int>(k) < a - 1) {
+    *a_final = k + 2;
+    *d_final = 0;
+  } else {
+    *a_final = 1;
+    *d_final = k - a + 2;
+  }
+}
+
+/* batch version: n independent battles with starts (a[i], d[i]) */
+void sample_outcomes(const outcome_sampler& S,
+                     int n,
+                     const int* a,
+                     const int* d,
+                     std::mt19937_64& gen,
+                     int* a_final,
+                     int* d_final)
+{
+  for (int i = 0; i < n; i++)
+    sample_outcome(S, a[i], d[i], gen, a_final + i, d_final + i);
+}
+
+/*
+  Battle length (number of dice rounds R until the battle is decided),
+  streamed row by row with the same stencil as stream_rows(). Each cell
+  carries a record of K + 4 values
+    mean, variance, P(R = 0), P(R = 1), ..., P(R = K), P(R > K)
+  where the last entry is the exact tail mass beyond the truncation K.
+  Terminal cells (a < 2 or d = 0) have R = 0. Since every round removes at
+  least one unit, R <= a - 1 + d, so K >= A + D - 1 gives the full distribution.
+  Every finished row (D + 1 records, d-major) is passed to on_row(a, row).
+*/
+template <typename RowFunc>
+bool stream_round_rows(int A,
+                       int D,
+                       int K,
+                       const std::vector<std::vector<int>>& dicetuples,
+                       const std::vector<std::vector<int>>& transitions,
+                       const std::vector<std::vector<double>>& probstable,
+                       RowFunc on_row)
+{
+  if (K < 0)
+    return false;
+
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+
+  const int R = K + 4;
+  const size_t W = static_cast<size_t>(D + 1) * R;
+  std::vector<double> rows(3 * W, 0.0);
+
+  for (int a = 0; a <= A; a++) {
+    double* cur = rows.data() + (a % 3) * W;
+    const double* src[3] = {cur,
+                            rows.data() + ((a + 2) % 3) * W,
+                            rows.data() + ((a + 1) % 3) * W};
+
+    for (int d = 0; d <= D; d++) {
+      double* rec = cur + static_cast<size_t>(d) * R;
+      std::fill(rec, rec + R, 0.0);
+
+      if (a < 2 || d == 0) {
+        rec[2] = 1.0;
+        continue;
+      }
+
+      const int q = dice_index[attacker_dice(a)][defender_dice(d)];
+      double mean = 1.0;
+      for (size_t i = 0; i < transitions.size(); i++) {
+        const double prob_qi = probstable[q][i];
+        if (prob_qi == 0)
+          continue;
+        const double* nbr = src[-transitions[i][0]] + static_cast<size_t>(d + transitions[i][1]) * R;
+        mean += prob_qi * nbr[0];
+        for (int r = 1; r <= K; r++)
+          rec[2 + r] += prob_qi * nbr[2 + r - 1];
+        rec[K + 3] += prob_qi * (nbr[2 + K] + nbr[K + 3]);
+      }
+
+      double var = 0.0;
+      for (size_t i = 0; i < transitions.size(); i++) {
+        const double prob_qi = probstable[q][i];
+        if (prob_qi == 0)
+          continue;
+        const double* nbr = src[-transitions[i][0]] + static_cast<size_t>(d + transitions[i][1]) * R;
+        const double dev = nbr[0] + 1.0 - mean;
+        var += prob_qi * (nbr[1] + dev * dev);
+      }
+
+      rec[0] = mean;
+      rec[1] = var;
+    }
+
+    if (!on_row(a, static_cast<const double*>(cur)))
+      return false;
+  }
+  return true;
+}
+
+/*
+  Forward mode sensitivities of P, streamed row by row. Each cell carries a
+  dual number with K = number of parameters derivative parts,
+    P, dP/dtheta_1, ..., dP/dtheta_K
+  and the stencil update is applied to the whole record:
+    dP(a, d) = sum_i [dp_i * P(nbr_i) + p_i * dP(nbr_i)].
+  The derivative parts are contiguous so the inner loop over the parameters
+  vectorizes. Boundary values do not depend on the dice (dP = 0).
+*/
+template <typename RowFunc>
+bool stream_sensitivity_rows(int A,
+                             int D,
+                             const std::vector<std::vector<int>>& dicetuples,
+                             const std::vector<std::vector<int>>& transitions,
+                             const std::vector<std::vector<double>>& probstable,
+                             const std::vector<std::vector<std::vector<double>>>& dprobstable,
+                             RowFunc on_row)
+{
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+
+  const int K = dprobstable[0][0].size();
+  const int R = K + 1;
+  const size_t W = static_cast<size_t>(D + 1) * R;
+  std::vector<double> rows(3 * W, 0.0);
+
+  for (int a = 0; a <= A; a++) {
+    double* cur = rows.data() + (a % 3) * W;
+    const double* src[3] = {cur,
+                            rows.data() + ((a + 2) % 3) * W,
+                            rows.data() + ((a + 1) % 3) * W};
+
+    for (int d = 0; d <= D; d++) {
+      double* rec = cur + static_cast<size_t>(d) * R;
+      std::fill(rec, rec + R, 0.0);
+
+      if (a < 2)
+        continue;
+      if (d == 0) {
+        rec[0] = 1.0;
+        continue;
+      }
+
+      const int q = dice_index[attacker_dice(a)][defender_dice(d)];
+      for (size_t i = 0; i < transitions.size(); i++) {
+        const double prob_qi = probstable[q][i];
+        const double* dprob_qi = dprobstable[q][i].data();
+        if (prob_qi == 0 && std::all_of(dprob_qi, dprob_qi + K, [](double x) { return x == 0; }))
+          continue;
+        if (d + transitions[i][1] < 0)
+          continue;  // only reached by impossible transitions (never with valid tables)
+        const double* nbr = src[-transitions[i][0]] + static_cast<size_t>(d + transitions[i][1]) * R;
+        const double val = nbr[0];
+        rec[0] += prob_qi * val;
+        for (int k = 0; k < K; k++)
+          rec[1 + k] += dprob_qi[k] * val + prob_qi * nbr[1 + k];
+      }
+    }
+
+    if (!on_row(a, static_cast<const double*>(cur)))
+      return false;
+  }
+  return true;
+}
+
+/*
+  Timeline tracing (--trace file). A trace_span records the begin and end
+  of a scope (a tile, a wait at a barrier or on a queue, formatting or
+  writing a row) as one event in a ring buffer of the calling thread; once
+  a thread has its ring this takes no lock and no allocation, and a full
+  ring overwrites its oldest events. write_json() dumps the events of all
+  threads in the Chrome trace event format (chrome://tracing,
+  ui.perfetto.dev), to be called after the traced threads have finished.
+  While no tracer is active (begin()) a span costs a load and a branch.
+*/
+struct trace_event {
+  const char* name;         // string literals
+  int64_t begin_ns, end_ns;
+  const char* arg_names[2]; // null: no argument
+  int64_t args[2];
+};
+
+struct trace_ring {
+  int tid = 0;
+  std::string thread_name;
+  std::vector<trace_event> events;
+  uint64_t count = 0;       // events recorded; the ring holds the last min(count, size)
+};
+
+class tracer;
+std::atomic<tracer*> active_tracer{nullptr};
+std::atomic<uint64_t> tracer_ids{0};
+
+class tracer {
+public:
+  explicit tracer(size_t events_per_thread = 1 << 16)
+    : id_(++tracer_ids), capacity_(std::max<size_t>(1, events_per_thread)), start_(std::chrono::steady_clock::now()) { }
+  ~tracer() { end(); }
+  tracer(const tracer&) = delete;
+  tracer& operator=(const tracer&) = delete;
+
+  /* record the spans of all threads from now on (one tracer at a time) */
+  void begin() { active_tracer.store(this, std::memory_order_release); }
+  void end() {
+    tracer* self = this;
+    active_tracer.compare_exchange_strong(self, nullptr);
+  }
+
+  int64_t now_ns() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+  }
+
+  void record(const trace_event& e) {
+    trace_ring& r = ring();
+    r.events[r.count % capacity_] = e;
+    r.count += 1;
+  }
+
+  void name_thread(const char* name) { ring().thread_name = name; }
+
+  /* events lost to full rings */
+  uint64_t dropped() const {
+    uint64_t n = 0;
+    for (const trace_ring& r : rings_)
+      n += (r.count > capacity_ ? r.count - capacity_ : 0);
+    return n;
+  }
+
+  void write_json(std::ostream& os) const {
+    os << "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": " << dropped()
+       << "}, \"traceEvents\": [" << std::endl;
+    bool first = true;
+    char buf[64];
+    for (const trace_ring& r : rings_) {
+      if (!r.thread_name.empty()) {
+        os << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << r.tid
+           << ", \"args\": {\"name\": \"" << r.thread_name << "\"}}";
+        first = false;
+      }
+      const uint64_t n = std::min<uint64_t>(r.count, capacity_);
+      for (uint64_t k = r.count - n; k < r.count; k++) {
+        const trace_event& e = r.events[k % capacity_];
+        std::snprintf(buf, sizeof(buf), "\"ts\": %.3f, \"dur\": %.3f", e.begin_ns * 1e-3, (e.end_ns - e.begin_ns) * 1e-3);
+        os << (first ? "" : ",\n") << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << r.tid
+           << ", " << buf;
+        if (e.arg_names[0] != nullptr) {
+          os << ", \"args\": {\"" << e.arg_names[0] << "\": " << e.args[0];
+          if (e.arg_names[1] != nullptr)
+            os << ", \"" << e.arg_names[1] << "\": " << e.args[1];
+          os << "}";
+        }
+        os << "}";
+        first = false;
+      }
+    }
+    os << std::endl << "]}" << std::endl;
+  }
+
+private:
+  /* the ring of the calling thread, created on first use */
+  trace_ring& ring() {
+    thread_local uint64_t owner = 0;
+    thread_local trace_ring* mine = nullptr;
+    if (owner != id_) {
+      std::lock_guard<std::mutex> lock(mtx_);
+      rings_.emplace_back();
+      mine = &rings_.back();
+      mine->tid = rings_.size();
+      mine->events.resize(capacity_);
+      owner = id_;
+    }
+    return *mine;
+  }
+
+  const uint64_t id_;
+  const size_t capacity_;
+  const std::chrono::steady_clock::time_point start_;
+  std::mutex mtx_;
+  std::deque<trace_ring> rings_;  // stable addresses
+};
+
+class trace_span {
+public:
+  explicit trace_span(const char* name,
+                      const char* arg0 = nullptr, int64_t value0 = 0,
+                      const char* arg1 = nullptr, int64_t value1 = 0)
+    : tracer_(active_tracer.load(std::memory_order_acquire))
+  {
+    if (tracer_ != nullptr)
+      event_ = {name, tracer_->now_ns(), 0, {arg0, arg1}, {value0, value1}};
+  }
+  ~trace_span() { end(); }
+  trace_span(const trace_span&) = delete;
+  trace_span& operator=(const trace_span&) = delete;
+
+  /* end the span before the end of the scope */
+  void end() {
+    if (tracer_ == nullptr)
+      return;
+    event_.end_ns = tracer_->now_ns();
+    tracer_->record(event_);
+    tracer_ = nullptr;
+  }
+private:
+  tracer* tracer_;
+  trace_event event_;
+};
+
+/* name the calling thread in the trace (if tracing) */
+void trace_thread_name(const char* name) {
+  if (tracer* t = active_tracer.load(std::memory_order_acquire))
+    t->name_thread(name);
+}
+
+/* reusable barrier for a fixed group of threads (std::barrier is C++20) */
+struct thread_barrier {
+  std::mutex mtx;
+  std::condition_variable cv;
+  int num_threads;
+  int waiting = 0;
+  long long generation = 0;
+
+  explicit thread_barrier(int n) : num_threads(n) { }
+
+  void wait() {
+    trace_span span("barrier_wait");
+    std::unique_lock<std::mutex> lock(mtx);
+    const long long gen = generation;
+    if (++waiting == num_threads) {
+      waiting = 0;
+      generation += 1;
+      cv.notify_all();
+    } else {
+      cv.wait(lock, [&] { return gen != generation; });
+    }
+  }
+};
+
+/*
+  A rule variant: uniform dice with the given number of sides plus the
+  modifiers of dice_rules. Variant files have one variant per line,
+    attacker_sides defender_sides [defender_bonus] [attacker_wins_ties]
+  and lines starting with # are ignored. The sides are limited to
+  2..max_variant_sides (create_prob_table enumerates sides^5 rolls).
+*/
+struct rule_variant {
+  int attacker_sides;
+  int defender_sides;
+  dice_rules rules;
+};
+
+const int max_variant_sides = 20;
+
+bool parse_variant_sides(const std::string& s, int& sides) {
+  char* end = nullptr;
+  const long int tmp = std::strtol(s.c_str(), &end, 0);
+  if (end == s.c_str() || *end != '\0' || tmp < 2 || tmp > max_variant_sides)
+    return false;
+  sides = static_cast<int>(tmp);
+  return true;
+}
+
+bool load_variants(const char* filename, std::vector<rule_variant>& variants) {
+  std::ifstream in(filename);
+  if (!in)
+    return false;
+  variants.clear();
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    std::string first;
+    if (!(ls >> first) || first[0] == '#')
+      continue;
+    rule_variant v;
+    int ties = 0;
+    std::string second;
+    if (!parse_variant_sides(first, v.attacker_sides) || !(ls >> second) || !parse_variant_sides(second, v.defender_sides))
+      return false;
+    if (!(ls >> v.rules.defender_bonus))
+      v.rules.defender_bonus = 0;
+    if (ls >> ties)
+      v.rules.attacker_wins_ties = (ties != 0);
+    variants.push_back(v);
+  }
+  return !variants.empty();
+}
+
+/*
+  Solve many rule variants in one pass. The grid traversal is the same for
+  all of them, so each cell holds one value per variant and every stencil
+  term is applied to all variants at once from a [q][i][variant] stacked
+  probability table (the variant loop is the vectorized inner loop; zero
+  probabilities contribute exact zeros, so each variant is bit-identical to
+  its own stream_rows() solve). The variants are split into contiguous
+  groups, one per thread; the threads meet at a barrier after every row,
+  and the assembled row, (D + 1) cells of V values, is passed to on_row.
+*/
+template <typename RowFunc>
+bool solve_variants(int A,
+                    int D,
+                    const std::vector<rule_variant>& variants,
+                    int num_threads,
+                    RowFunc on_row)
+{
+  const int V = variants.size();
+  const int num_transitions = 5;
+  const int num_tuples = 6;
+
+  std::vector<std::vector<int>> dicetuples;
+  std::vector<std::vector<int>> transitions;
+  std::vector<double> stacked(num_tuples * num_transitions * V);
+
+  for (int v = 0; v < V; v++) {
+    std::vector<std::vector<double>> probstable;
+    const std::vector<double> fa(variants[v].attacker_sides, 1.0 / variants[v].attacker_sides);
+    const std::vector<double> fd(variants[v].defender_sides, 1.0 / variants[v].defender_sides);
+    if (!create_prob_table_weighted(dicetuples, transitions, probstable, nullptr, fa, fd, variants[v].rules))
+      return false;
+    for (int q = 0; q < num_tuples; q++)
+      for (int i = 0; i < num_transitions; i++)
+        stacked[(q * num_transitions + i) * V + v] = probstable[q][i];
+  }
+
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+
+  if (num_threads < 1)
+    num_threads = 1;
+  if (num_threads > V)
+    num_threads = V;
+
+  std::vector<double> row_out(static_cast<size_t>(D + 1) * V);
+  thread_barrier barrier(num_threads);
+  bool keep_going = true;
+
+  auto worker = [&](int t) {
+    const int v0 = (V * t) / num_threads;
+    const int G = (V * (t + 1)) / num_threads - v0;
+    const size_t W = static_cast<size_t>(D + 1) * G;
+    std::vector<double> rows(3 * W, 0.0);
+
+    for (int a = 0; a <= A; a++) {
+      double* cur = rows.data() + (a % 3) * W;
+      const double* src[3] = {cur,
+                              rows.data() + ((a + 2) % 3) * W,
+                              rows.data() + ((a + 1) % 3) * W};
+
+      for (int d = 0; d <= D; d++) {
+        double* rec = cur + static_cast<size_t>(d) * G;
+        if (a < 2 || d == 0) {
+          std::fill(rec, rec + G, (a < 2 ? 0.0 : 1.0));
+          continue;
+        }
+        std::fill(rec, rec + G, 0.0);
+        const int na = attacker_dice(a);
+        const int nd = defender_dice(d);
+        const int q = dice_index[na][nd];
+        for (int i = 0; i < num_transitions; i++) {
+          // units lost per round = number of dice compared; other transitions are zero in every variant
+          if (-transitions[i][0] - transitions[i][1] != std::min(na, nd))
+            continue;
+          const double* prob_qi = stacked.data() + (q * num_transitions + i) * V + v0;
+          const double* nbr = src[-transitions[i][0]] + static_cast<size_t>(d + transitions[i][1]) * G;
+          for (int g = 0; g < G; g++)
+            rec[g] += prob_qi[g] * nbr[g];
+        }
+      }
+
+      for (int d = 0; d <= D; d++)
+        std::copy(cur + static_cast<size_t>(d) * G, cur + static_cast<size_t>(d + 1) * G,
+                  row_out.begin() + static_cast<size_t>(d) * V + v0);
+
+      barrier.wait();
+      if (t == 0)
+        keep_going = on_row(a, static_cast<const double*>(row_out.data()));
+      barrier.wait();
+      if (!keep_going)
+        break;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 1; t < num_threads; t++)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for (auto& w : workers)
+    w.join();
+
+  return keep_going;
+}
+
+/*
+  Column solver with a parallel scan along the attacker axis. For fixed d
+  and a >= 4 (three attacker dice) the stencil is a linear recurrence in a
+  with constant coefficients,
+    x(a) = c1 * x(a - 1) + c2 * x(a - 2) + f(a),
+  where the forcing f(a) only involves the already finished columns d - 1
+  and d - 2. With the state s(a) = (x(a), x(a - 1)) this is the affine map
+  s(a) = M s(a - 1) + (f(a), 0), M = [[c1, c2], [1, 0]], so a block of the
+  column composes to s(hi) = M^len s(lo - 1) + g. Each thread takes one
+  block of a: (1) run the recurrence from a zero state to get g, (2) the
+  block entry states are chained serially, (3) rerun the block from its
+  true entry state. The columns (length A + 1) are passed to on_column(d,
+  column) in order; only three are kept. The result agrees with the
+  sequential DP to roundoff (the order of operations differs).
+*/
+struct affine2 {
+  double m[2][2];
+  double g[2];
+};
+
+void mul2(const double X[2][2], const double Y[2][2], double Z[2][2]) {
+  double T[2][2];
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      T[i][j] = X[i][0] * Y[0][j] + X[i][1] * Y[1][j];
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      Z[i][j] = T[i][j];
+}
+
+template <typename ColumnFunc>
+bool solve_columns_scan(int A,
+                        int D,
+                        const std::vector<std::vector<int>>& dicetuples,
+                        const std::vector<std::vector<int>>& transitions,
+                        const std::vector<std::vector<double>>& probstable,
+                        int num_threads,
+                        ColumnFunc on_column)
+{
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+
+  const size_t W = static_cast<size_t>(A) + 1;
+  std::vector<double> cols(3 * W, 0.0);
+
+  // blocks of the scanned range a = 4..A
+  const long long scan_len = (A >= 4 ? A - 3 : 0);
+  if (num_threads < 1)
+    num_threads = 1;
+  if (scan_len < 64LL * num_threads)
+    num_threads = 1;
+
+  std::vector<affine2> block(num_threads);
+  std::vector<double> entry(2 * num_threads);
+  thread_barrier barrier(num_threads);
+  bool keep_going = true;
+
+  // column d: coefficients of the recurrence and the forcing for a >= 4
+  auto forcing = [&](const double* const* src, int q, int a) {
+    double f = 0.0;
+    for (size_t i = 0; i < transitions.size(); i++) {
+      const double prob_qi = probstable[q][i];
+      if (prob_qi == 0 || transitions[i][1] == 0)
+        continue;
+      f += prob_qi * src[-transitions[i][1]][a + transitions[i][0]];
+    }
+    return f;
+  };
+
+  auto worker = [&](int t) {
+    const int lo = 4 + static_cast<int>((scan_len * t) / num_threads);
+    const int hi = 3 + static_cast<int>((scan_len * (t + 1)) / num_threads);
+    if (t > 0)
+      trace_thread_name("scan");
+
+    for (int d = 0; d <= D; d++) {
+      trace_span span("column", "d", d);
+      double* cur = cols.data() + (d % 3) * W;
+      const double* src[3] = {cur,
+                              cols.data() + ((d + 2) % 3) * W,    // column d - 1
+                              cols.data() + ((d + 1) % 3) * W};   // column d - 2
+
+      if (d == 0) {
+        for (int a = lo; a <= hi; a++)
+          cur[a] = 1.0;
+        if (t == 0)
+          for (int a = 0; a <= std::min(A, 3); a++)
+            cur[a] = (a >= 2 ? 1.0 : 0.0);
+      } else {
+        const int q = dice_index[3][defender_dice(d)];
+        double c1 = 0.0, c2 = 0.0;
+        for (size_t i = 0; i < transitions.size(); i++) {
+          if (transitions[i][1] != 0) continue;
+          if (transitions[i][0] == -1) c1 = probstable[q][i];
+          if (transitions[i][0] == -2) c2 = probstable[q][i];
+        }
+
+        if (t == 0) {
+          // a = 0..3 directly (fewer attacker dice)
+          for (int a = 0; a <= std::min(A, 3); a++) {
+            if (a < 2) {
+              cur[a] = 0.0;
+              continue;
+            }
+            const int qa = dice_index[attacker_dice(a)][defender_dice(d)];
+            double this_val = 0.0;
+            for (size_t i = 0; i < transitions.size(); i++) {
+              const double prob_qi = probstable[qa][i];
+              if (prob_qi == 0)
+                continue;
+              this_val += prob_qi * src[-transitions[i][1]][a + transitions[i][0]];
+            }
+            cur[a] = this_val;
+          }
+        }
+
+        // (1) forcing and the block map from a zero entry state
+        double y1 = 0.0, y2 = 0.0;
+        for (int a = lo; a <= hi; a++) {
+          const double f = forcing(src, q, a);
+          cur[a] = f;
+          const double y = c1 * y1 + c2 * y2 + f;
+          y2 = y1;
+          y1 = y;
+        }
+        affine2& B = block[t];
+        B.g[0] = y1;
+        B.g[1] = y2;
+        double P2[2][2] = {{1.0, 0.0}, {0.0, 1.0}};
+        double M[2][2] = {{c1, c2}, {1.0, 0.0}};
+        for (int n = hi - lo + 1; n > 0; n >>= 1) {
+          if (n & 1)
+            mul2(P2, M, P2);
+          mul2(M, M, M);
+        }
+        for (int i = 0; i < 2; i++)
+          for (int j = 0; j < 2; j++)
+            B.m[i][j] = P2[i][j];
+
+        // (2) chain the block entry states
+        if (num_threads > 1)
+          barrier.wait();
+        if (t == 0) {
+          double s0 = (A >= 3 ? cur[3] : 0.0);
+          double s1 = cur[2];
+          for (int b = 0; b < num_threads; b++) {
+            entry[2 * b] = s0;
+            entry[2 * b + 1] = s1;
+            const double n0 = block[b].m[0][0] * s0 + block[b].m[0][1] * s1 + block[b].g[0];
+            const double n1 = block[b].m[1][0] * s0 + block[b].m[1][1] * s1 + block[b].g[1];
+            s0 = n0;
+            s1 = n1;
+          }
+        }
+        if (num_threads > 1)
+          barrier.wait();
+
+        // (3) rerun the block from its true entry state
+        double x1 = entry[2 * t];
+        double x2 = entry[2 * t + 1];
+        for (int a = lo; a <= hi; a++) {
+          const double x = c1 * x1 + c2 * x2 + cur[a];
+          cur[a] = x;
+          x2 = x1;
+          x1 = x;
+        }
+      }
+
+      if (num_threads > 1)
+        barrier.wait();
+      if (t == 0)
+        keep_going = on_column(d, static_cast<const double*>(cur));
+      if (num_threads > 1)
+        barrier.wait();
+      if (!keep_going)
+        break;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 1; t < num_threads; t++)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for (auto& w : workers)
+    w.join();
+
+  return keep_going;
+}
+
+/*
+  Direct evaluation of the single value P(A, D) without a table. Inside
+  the 3v2 regime I = {a >= 4, d >= 2} every round is one of the three steps
+  (-2, 0), (-1, -1), (0, -2) with fixed probabilities p0, p1, p2, so the
+  probability of reaching X = (x, y) in I from (A, D) after i, j, k steps
+  of each kind is the multinomial sum
+    Pr(X) = sum_j n! / (i! j! k!) p0^i p1^j p2^k,
+    i = (A - x - j) / 2,  k = (D - y - j) / 2,  n = i + j + k (fixed).
+  Both coordinates only decrease, so every such path stays in I. The
+  battle leaves I through one step from an X with x <= 5 or y <= 3, hence
+    P(A, D) = sum_X Pr(X) sum_{steps s leaving I} p_s P(X + s),
+  where the values outside I (a <= 3, or d <= 1) form a small boundary
+  table computed by streaming: rows a = 0..3 (length D + 1) and the
+  column d = 1 (length A + 1).
+
+  The terms of each multinomial sum are log-concave in j: the mode is
+  located by bisection on the term ratio, evaluated with lgammal(), and
+  the sum is accumulated relative to that term (term ratios are cheap
+  rational functions of j) outward from the mode until the terms drop
+  below 1e-18 relative. Points X whose largest term is below exp(-60)
+  are skipped. Cost is O(A + D) lgammal() calls plus
+  O(sqrt(A + D)) work per significant X, and O(A + D) memory.
+*/
+bool direct_cell_probability(int A,
+                             int D,
+                             const std::vector<std::vector<int>>& dicetuples,
+                             const std::vector<std::vector<int>>& transitions,
+                             const std::vector<std::vector<double>>& probstable,
+                             double* result)
+{
+  if (A < 0 || D < 0)
+    return false;
+
+  // boundary table: rows a = 0..3, and column d = 1 for a = 0..A
+  std::vector<double> low_rows(4 * static_cast<size_t>(D + 1), 0.0);
+  stream_rows(std::min(A, 3), D, dicetuples, transitions, probstable,
+              [&](int a, const double* row) {
+                std::copy(row, row + D + 1, low_rows.begin() + a * static_cast<size_t>(D + 1));
+                return true;
+              });
+  std::vector<double> col1(A + 1, 0.0);
+  if (D >= 1) {
+    stream_rows(A, 1, dicetuples, transitions, probstable,
+                [&](int a, const double* row) { col1[a] = row[1]; return true; });
+  }
+
+  auto outside_value = [&](int a, int d) {
+    if (a <= 3)
+      return low_rows[a * static_cast<size_t>(D + 1) + d];
+    if (d == 0)
+      return 1.0;
+    return col1[a];
+  };
+
+  if (A <= 3 || D <= 1) {
+    *result = outside_value(A, D);
+    return true;
+  }
+
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+  const int q = dice_index[3][2];
+  double p[3] = {0.0, 0.0, 0.0};   // (-2, 0), (-1, -1), (0, -2)
+  const int step_a[3] = {-2, -1, 0};
+  const int step_d[3] = {0, -1, -2};
+  for (size_t i = 0; i < transitions.size(); i++) {
+    int s = -1;
+    for (int m = 0; m < 3; m++)
+      if (transitions[i][0] == step_a[m] && transitions[i][1] == step_d[m])
+        s = m;
+    if (s < 0 && probstable[q][i] != 0)
+      return false;   // not a two-comparison rule set
+    if (s >= 0)
+      p[s] = probstable[q][i];
+  }
+  if (p[0] <= 0 || p[1] <= 0 || p[2] <= 0)
+    return false;
+
+  const long double lp0 = std::log(static_cast<long double>(p[0]));
+  const long double lp1 = std::log(static_cast<long double>(p[1]));
+  const long double lp2 = std::log(static_cast<long double>(p[2]));
+  const long double lc = 2 * lp1 - lp0 - lp2;    // log of term(j + 2) / term(j) without the counts
+  const long double c = std::exp(lc);
+
+  // log Pr(reach (x, y)) or -infinity
+  auto log_reach = [&](int x, int y) -> long double {
+    const long long Ra = static_cast<long long>(A) - x;
+    const long long Rd = static_cast<long long>(D) - y;
+    if (((Ra ^ Rd) & 1) != 0)
+      return -INFINITY;
+    const long long j_lo = (Ra & 1);
+    const long long j_hi = std::min(Ra, Rd);
+    const long long n = (Ra + Rd) / 2;
+
+    auto log_term = [&](long long j) {
+      const long long i = (Ra - j) / 2;
+      const long long k = (Rd - j) / 2;
+      return lgammal(n + 1) - lgammal(i + 1) - lgammal(j + 1) - lgammal(k + 1) + i * lp0 + j * lp1 + k * lp2;
+    };
+    // term(j + 2) / term(j)
+    auto ratio = [&](long long j) {
+      const long double i = (Ra - j) / 2;
+      const long double k = (Rd - j) / 2;
+      return c * i * k / (static_cast<long double>(j + 1) * (j + 2));
+    };
+
+    // mode: first j where the ratio drops below one
+    long long m_lo = 0, m_hi = (j_hi - j_lo) / 2;
+    while (m_lo < m_hi) {
+      const long long m = (m_lo + m_hi) / 2;
+      if (ratio(j_lo + 2 * m) >= 1)
+        m_lo = m + 1;
+      else
+        m_hi = m;
+    }
+    const long long j_mode = j_lo + 2 * m_lo;
+    const long double t_mode = log_term(j_mode);
+    if (t_mode < -60)
+      return -INFINITY;
+
+    // terms relative to the mode, walking outward
+    const long double tiny = 1e-18L;
+    long double sum = 1.0;
+    long double rel = 1.0;
+    for (long long j = j_mode; j + 2 <= j_hi; j += 2) {
+      rel *= ratio(j);
+      if (rel < tiny)
+        break;
+      sum += rel;
+    }
+    rel = 1.0;
+    for (long long j = j_mode - 2; j >= j_lo; j -= 2) {
+      rel /= ratio(j);
+      if (rel < tiny)
+        break;
+      sum += rel;
+    }
+    return t_mode + std::log(sum);
+  };
+
+  long double total = 0.0;
+  auto add_exits = [&](int x, int y) {
+    const long double lr = log_reach(x, y);
+    if (lr == -INFINITY)
+      return;
+    const long double reach = std::exp(lr);
+    for (int s = 0; s < 3; s++) {
+      const int ex = x + step_a[s];
+      const int ey = y + step_d[s];
+      if (ex <= 3 || ey <= 1)
+        total += reach * p[s] * outside_value(ex, ey);
+    }
+  };
+
+  for (int x = 4; x <= std::min(A, 5); x++)
+    for (int y = 2; y <= D; y++)
+      add_exits(x, y);
+  for (int y = 2; y <= std::min(D, 3); y++)
+    for (int x = 6; x <= A; x++)
+      add_exits(x, y);
+
+  *result = static_cast<double>(total);
+  return true;
+}
+
+/*
+  Asymptotic evaluator for large armies. Deep in the 3v2 regime each
+  round removes X in {0, 1, 2} defender units (and 2 - X attacker units)
+  with probabilities p0, p1, p2 from probstable. The battle is decided
+  after about N = (a + d - 1) / 2 rounds, and the attacker wins roughly
+  when the defender losses S_N reach d, so with the mean mu, deviation
+  sigma and skewness gamma of X, an Edgeworth corrected normal tail gives
+    P(a, d) ~ Q(z) + phi(z) gamma / (6 sqrt(N)) (z^2 - 1),
+    z = (d - delta - N mu) / (sigma sqrt(N)).
+  The shift delta absorbs the lattice and boundary effects; it is fitted
+  against the exact DP (streamed up to a calibration size M), which also
+  provides the error estimate C (a + d)^-alpha from the maximum errors on
+  the bands a + d in [M/4, M/2] and [M/2, M] (with a safety factor 2).
+  evaluate_battle() uses the exact direct evaluator up to a + d <=
+  exact_limit and the approximation beyond.
+*/
+struct battle_approx {
+  double mu, sigma, gamma;
+  double delta;
+  double err_c, err_alpha;
+  int exact_limit;
+  std::vector<std::vector<int>> dicetuples;
+  std::vector<std::vector<int>> transitions;
+  std::vector<std::vector<double>> probstable;
+};
+
+double approx_probability(const battle_approx& B, double a, double d, double delta) {
+  const double N = (a + d - 1.0) / 2.0;
+  const double z = (d - delta - N * B.mu) / (B.sigma * std::sqrt(N));
+  const double phi = std::exp(-0.5 * z * z) / std::sqrt(2.0 * M_PI);
+  const double P = 0.5 * std::erfc(z / std::sqrt(2.0)) + phi * B.gamma / (6.0 * std::sqrt(N)) * (z * z - 1.0);
+  return (P < 0.0 ? 0.0 : (P > 1.0 ? 1.0 : P));
+}
+
+double approx_error_bound(const battle_approx& B, double a, double d) {
+  return B.err_c * std::pow(a + d, -B.err_alpha);
+}
+
+bool calibrate_battle_approx(battle_approx& B,
+                             int M,
+                             int exact_limit,
+                             const std::vector<std::vector<int>>& dicetuples,
+                             const std::vector<std::vector<int>>& transitions,
+                             const std::vector<std::vector<double>>& probstable)
+{
+  if (M < 64)
+    return false;
+
+  B.dicetuples = dicetuples;
+  B.transitions = transitions;
+  B.probstable = probstable;
+  B.exact_limit = exact_limit;
+
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+  const int q = dice_index[3][2];
+  double p[3] = {0.0, 0.0, 0.0};   // defender loses 0, 1, 2 units
+  for (size_t i = 0; i < transitions.size(); i++) {
+    const int loss_d = -transitions[i][1];
+    if (loss_d + (-transitions[i][0]) == 2)
+      p[loss_d] += probstable[q][i];
+  }
+  B.mu = p[1] + 2.0 * p[2];
+  double m2 = 0.0, m3 = 0.0;
+  for (int x = 0; x < 3; x++) {
+    m2 += p[x] * (x - B.mu) * (x - B.mu);
+    m3 += p[x] * (x - B.mu) * (x - B.mu) * (x - B.mu);
+  }
+  if (m2 <= 0.0)
+    return false;
+  B.sigma = std::sqrt(m2);
+  B.gamma = m3 / (m2 * B.sigma);
+
+  // exact values on the triangle a + d <= M (a >= 4, d >= 2), as floats
+  std::vector<float> exact(static_cast<size_t>(M + 1) * (M + 1), 0.0f);
+  stream_rows(M, M, dicetuples, transitions, probstable,
+              [&](int a, const double* row) {
+                for (int d = 0; d <= M - a; d++)
+                  exact[static_cast<size_t>(a) * (M + 1) + d] = row[d];
+                return true;
+              });
+
+  // max error over the cells with n_lo <= a + d <= n_hi (sparse subsample)
+  auto band_error = [&](int n_lo, int n_hi, double delta) {
+    const int stride = 1 + n_hi / 512;
+    double e = 0.0;
+    for (int a = 4; a <= n_hi; a += stride)
+      for (int d = std::max(2, n_lo - a); d <= n_hi - a; d += stride)
+        e = std::max(e, std::fabs(approx_probability(B, a, d, delta) - exact[static_cast<size_t>(a) * (M + 1) + d]));
+    return e;
+  };
+
+  // golden section search for the shift on the outer band
+  double lo = -2.0, hi = 2.0;
+  const double g = 0.5 * (std::sqrt(5.0) - 1.0);
+  double x1 = hi - g * (hi - lo), x2 = lo + g * (hi - lo);
+  double f1 = band_error(M / 2, M, x1), f2 = band_error(M / 2, M, x2);
+  for (int it = 0; it < 40; it++) {
+    if (f1 < f2) {
+      hi = x2; x2 = x1; f2 = f1;
+      x1 = hi - g * (hi - lo);
+      f1 = band_error(M / 2, M, x1);
+    } else {
+      lo = x1; x1 = x2; f1 = f2;
+      x2 = lo + g * (hi - lo);
+      f2 = band_error(M / 2, M, x2);
+    }
+  }
+  B.delta = 0.5 * (lo + hi);
+
+  const double e1 = band_error(M / 4, M / 2, B.delta);
+  const double e2 = band_error(M / 2, M, B.delta);
+  double alpha = (e2 > 0.0 ? std::log(e1 / e2) / std::log(2.0) : 1.0);
+  alpha = std::min(1.0, std::max(0.5, alpha));
+  B.err_alpha = alpha;
+  B.err_c = 2.0 * e2 * std::pow(M / 2.0, alpha);
+  return true;
+}
+
+/* exact below the switch size, approximate above; *err is the error estimate (0 if exact) */
+double evaluate_battle(const battle_approx& B, int a, int d, double* err) {
+  if (static_cast<long long>(a) + d <= B.exact_limit || a < 4 || d < 2) {
+    double value = 0.0;
+    if (direct_cell_probability(a, d, B.dicetuples, B.transitions, B.probstable, &value)) {
+      if (err != nullptr) *err = 0.0;
+      return value;
+    }
+  }
+  if (err != nullptr) *err = approx_error_bound(B, a, d);
+  return approx_probability(B, a, d, B.delta);
+}
+
+/*
+  Compact approximate lookup of P over [0..A] x [0..D]. Cells with
+  a, d <= S0 come from a small exact block. Everywhere else the value is
+  the calibrated asymptotic model of battle_approx plus a residual that is
+  bilinearly interpolated on a grid in the coordinates
+    z = (d - delta - N mu) / (sigma sqrt(N)),  t = log(a + d),
+  in which P varies slowly (the transition zone is a fixed band in z at
+  every scale). Every 3v2 round removes two units, so cells with even and
+  odd a + d form two separate smooth sheets; each parity has its own
+  residual grid. Outside |z| <= z_max the residual is taken as zero.
+
+  build_lookup_surface() fills the grid from the exact DP (streamed; every
+  node takes the residual of its nearest cell) and then certifies it by a
+  second streamed sweep that evaluates the surface at every cell of the
+  domain. If the certified maximum error is above the tolerance the grid is
+  refined (doubling z and t resolution in turn) until it fits, or until
+  the next grid would exceed max_bytes. Memory is O(D) during the build.
+*/
+struct lookup_surface {
+  battle_approx model;
+  int A, D;
+  int S0;
+  std::vector<float> block;       // (S0 + 1) x (S0 + 1), a-major
+  int nz, nt;
+  double z_max, t0, t1;
+  std::vector<float> residual;    // 2 x nt x nz (parity of a + d, t, z)
+  double max_error;               // certified over the whole domain
+};
+
+inline void surface_coordinates(const lookup_surface& L, int a, int d, double* z, double* t) {
+  const double n = static_cast<double>(a) + d;
+  const double N = (n - 1.0) / 2.0;
+  *z = (d - L.model.delta - N * L.model.mu) / (L.model.sigma * std::sqrt(N));
+  *t = std::log(n);
+}
+
+double surface_probability(const lookup_surface& L, int a, int d) {
+  if (a <= L.S0 && d <= L.S0)
+    return L.block[a * (L.S0 + 1) + d];
+
+  double z, t;
+  surface_coordinates(L, a, d, &z, &t);
+  double P = approx_probability(L.model, a, d, L.model.delta);
+  if (std::fabs(z) < L.z_max) {
+    const double u = (z + L.z_max) / (2.0 * L.z_max) * (L.nz - 1);
+    const double v = std::min(std::max((t - L.t0) / (L.t1 - L.t0), 0.0), 1.0) * (L.nt - 1);
+    const int iu = std::min(static_cast<int>(u), L.nz - 2);
+    const int iv = std::min(static_cast<int>(v), L.nt - 2);
+    const double fu = u - iu, fv = v - iv;
+    const float* r0 = L.residual.data() + (((a + d) & 1) * L.nt + iv) * L.nz + iu;
+    const float* r1 = r0 + L.nz;
+    P += (1.0 - fv) * ((1.0 - fu) * r0[0] + fu * r0[1]) + fv * ((1.0 - fu) * r1[0] + fu * r1[1]);
+  }
+  return (P < 0.0 ? 0.0 : (P > 1.0 ? 1.0 : P));
+}
+
+size_t surface_bytes(const lookup_surface& L) {
+  return sizeof(float) * (L.block.size() + L.residual.size()) + sizeof(lookup_surface);
+}
+
+bool build_lookup_surface(lookup_surface& L,
+                          const battle_approx& model,
+                          int A,
+                          int D,
+                          double tolerance,
+                          size_t max_bytes)
+{
+  L.model = model;
+  L.A = A;
+  L.D = D;
+  L.S0 = std::min(63, std::min(A, D));
+  L.block.assign((L.S0 + 1) * (L.S0 + 1), 0.0f);
+  L.z_max = 8.0;
+  L.t0 = std::log(L.S0 + 1.0);
+  L.t1 = std::log(static_cast<double>(A) + D);
+  if (L.t1 <= L.t0)
+    L.t1 = L.t0 + 1.0;
+  L.nz = 32;
+  L.nt = 8;
+
+  const auto& dt = model.dicetuples;
+  const auto& tr = model.transitions;
+  const auto& pt = model.probstable;
+
+  for (int level = 0; ; level++) {
+    // nodes -> nearest cells, grouped by row
+    L.residual.assign(2 * L.nz * L.nt, 0.0f);
+    std::vector<std::vector<std::pair<int, int>>> wanted(A + 1);   // row a: (d, node)
+    for (int j = 0; j < L.nt; j++) {
+      const double n = std::exp(L.t0 + (L.t1 - L.t0) * j / (L.nt - 1));
+      const double N = (n - 1.0) / 2.0;
+      for (int i = 0; i < L.nz; i++) {
+        const double z = -L.z_max + 2.0 * L.z_max * i / (L.nz - 1);
+        const double d = model.delta + N * model.mu + z * model.sigma * std::sqrt(N);
+        const int di = std::min(std::max(static_cast<int>(std::lround(d)), 0), D);
+        for (int parity = 0; parity < 2; parity++) {
+          int ai = static_cast<int>(std::lround(n - d));
+          if (((ai + di) & 1) != parity)
+            ai += (n - d > ai ? 1 : -1);
+          if (ai < 0 || ai > A)
+            ai += 2 * (ai < 0 ? 1 : -1);
+          if (ai < 0 || ai > A)
+            continue;
+          wanted[ai].push_back({di, (parity * L.nt + j) * L.nz + i});
+        }
+      }
+    }
+
+    stream_rows(A, D, dt, tr, pt,
+                [&](int a, const double* row) {
+                  if (a <= L.S0)
+                    for (int d = 0; d <= L.S0; d++)
+                      L.block[a * (L.S0 + 1) + d] = row[d];
+                  for (const auto& w : wanted[a]) {
+                    if (a + w.first < 2)
+                      continue;
+                    L.residual[w.second] = row[w.first] - approx_probability(model, a, w.first, model.delta);
+                  }
+                  return true;
+                });
+
+    // certify over every cell
+    L.max_error = 0.0;
+    stream_rows(A, D, dt, tr, pt,
+                [&](int a, const double* row) {
+                  for (int d = 0; d <= D; d++)
+                    L.max_error = std::max(L.max_error, std::fabs(surface_probability(L, a, d) - row[d]));
+                  return true;
+                });
+
+    if (L.max_error <= tolerance)
+      return true;
+    const size_t next_bytes = surface_bytes(L) + sizeof(float) * L.residual.size();
+    if (next_bytes > max_bytes)
+      return false;
+    if (level % 2 == 0)
+      L.nz = 2 * L.nz - 1;
+    else
+      L.nt = 2 * L.nt - 1;
+  }
+}
+
+/*
+  Compressed in-memory table with O(1) random access. The grid is cut into
+  tiles of T x T cells (T = 64 rows of a by 64 columns of d). A tile whose
+  values span at most 2 * eps (saturated regions: all 0 or all 1 up to eps)
+  is stored as a single value; any other tile stores 16-bit codes
+    P(a, d) = lo + step * code,   step = (hi - lo) / 65535,
+  with a quantization error of at most step / 2. Decoding a cell is one
+  tile header lookup and at most one code load. build_compressed_table()
+  consumes the row stream of the solver and buffers T rows at a time, so
+  the dense table is never formed; the maximum decode error over all cells
+  is measured while encoding.
+*/
+struct compressed_table {
+  int A, D;
+  int tile;
+  int tiles_d;                     // tiles per tile row
+  std::vector<double> tile_lo;
+  std::vector<double> tile_step;   // 0 for constant tiles
+  std::vector<size_t> tile_offset; // into codes (T * T codes per coded tile)
+  std::vector<uint16_t> codes;
+  double max_error;
+};
+
+inline double compressed_value(const compressed_table& C, int a, int d) {
+  const int T = C.tile;
+  const size_t t = static_cast<size_t>(a / T) * C.tiles_d + d / T;
+  const double step = C.tile_step[t];
+  if (step == 0.0)
+    return C.tile_lo[t];
+  return C.tile_lo[t] + step * C.codes[C.tile_offset[t] + (a % T) * T + (d % T)];
+}
+
+size_t compressed_bytes(const compressed_table& C) {
+  return C.tile_lo.size() * (2 * sizeof(double) + sizeof(size_t)) + C.codes.size() * sizeof(uint16_t);
+}
+
+bool build_compressed_table(compressed_table& C,
+                            int A,
+                            int D,
+                            double eps,
+                            const std::vector<std::vector<int>>& dicetuples,
+                            const std::vector<std::vector<int>>& transitions,
+                            const std::vector<std::vector<double>>& probstable)
+{
+  const int T = 64;
+  C.A = A;
+  C.D = D;
+  C.tile = T;
+  C.tiles_d = D / T + 1;
+  C.tile_lo.clear();
+  C.tile_step.clear();
+  C.tile_offset.clear();
+  C.codes.clear();
+  C.max_error = 0.0;
+
+  const size_t W = static_cast<size_t>(D) + 1;
+  std::vector<double> band(static_cast<size_t>(T) * W);
+
+  auto encode_band = [&](int rows) {
+    for (int td = 0; td < C.tiles_d; td++) {
+      const int d0 = td * T;
+      const int cols = std::min(T, D + 1 - d0);
+      double lo = 1.0, hi = 0.0;
+      for (int r = 0; r < rows; r++)
+        for (int c = 0; c < cols; c++) {
+          const double v = band[r * W + d0 + c];
+          lo = std::min(lo, v);
+          hi = std::max(hi, v);
+        }
+
+      C.tile_offset.push_back(C.codes.size());
+      if (hi - lo <= 2.0 * eps) {
+        const double mid = 0.5 * (lo + hi);
+        C.tile_lo.push_back(mid);
+        C.tile_step.push_back(0.0);
+        C.max_error = std::max(C.max_error, std::max(hi - mid, mid - lo));
+        continue;
+      }
+
+      const double step = (hi - lo) / 65535.0;
+      C.tile_lo.push_back(lo);
+      C.tile_step.push_back(step);
+      const size_t off = C.codes.size();
+      C.codes.resize(off + static_cast<size_t>(T) * T, 0);
+      for (int r = 0; r < rows; r++)
+        for (int c = 0; c < cols; c++) {
+          const double v = band[r * W + d0 + c];
+          const long code = std::lround((v - lo) / step);
+          const uint16_t k = static_cast<uint16_t>(std::min(65535L, std::max(0L, code)));
+          C.codes[off + r * T + c] = k;
+          C.max_error = std::max(C.max_error, std::fabs(lo + step * k - v));
+        }
+    }
+  };
+
+  stream_rows(A, D, dicetuples, transitions, probstable,
+              [&](int a, const double* row) {
+                std::copy(row, row + W, band.begin() + static_cast<size_t>(a % T) * W);
+                if (a % T == T - 1 || a == A)
+                  encode_band(a % T + 1);
+                return true;
+              });
+  return true;
+}
+
+/*
+  Lossless compressed container for the table. Layout (native byte order):
+    header   char magic[8] = "DPRKTBL1", int32 A, D, tile, int32 reserved,
+             uint64 number of tiles, uint64 file offset of the index
+    payload  the encoded tiles, one after another
+    index    per tile (tile row major): uint64 offset, uint64 size
+  A tile holds up to T x T cells (T rows of a, T columns of d) in row
+  major order. Each value is XOR-ed with its predictor (the cell to the
+  left, or above for the first column), and the XOR residuals are bit
+  packed as in Gorilla: '0' for a zero residual, otherwise '1', 6 bits of
+  leading zeros, 6 bits of (number of significant bits - 1) and the
+  significant bits. Saturated regions cost one bit per cell.
+
+  write_container() takes the row stream of the solver, encodes each band
+  of T rows with its tiles spread over the threads, and appends it, so the
+  full table is never in memory. read_container_tile() fetches and decodes
+  a single tile via the index; read_container() decodes all tiles in
+  parallel.
+*/
+struct bit_writer {
+  std::vector<uint8_t> bytes;
+  uint64_t acc = 0;
+  int nbits = 0;
+
+  void put(uint64_t value, int n) {   // n <= 64, most significant first
+    for (int k = n - 1; k >= 0; k--) {
+      acc = (acc << 1) | ((value >> k) & 1);
+      if (++nbits == 8) {
+        bytes.push_back(static_cast<uint8_t>(acc));
+        acc = 0;
+        nbits = 0;
+      }
+    }
+  }
+
+  void flush() {
+    if (nbits > 0)
+      bytes.push_back(static_cast<uint8_t>(acc << (8 - nbits)));
+    acc = 0;
+    nbits = 0;
+  }
+};
+
+struct bit_reader {
+  const uint8_t* bytes;
+  size_t size;
+  size_t pos = 0;   // in bits
+
+  bit_reader(const uint8_t* b, size_t n) : bytes(b), size(n) { }
+
+  uint64_t get(int n) {
+    uint64_t value = 0;
+    for (int k = 0; k < n; k++, pos++) {
+      const size_t byte = pos >> 3;
+      const int bit = (byte < size ? (bytes[byte] >> (7 - (pos & 7))) & 1 : 0);
+      value = (value << 1) | bit;
+    }
+    return value;
+  }
+};
+
+inline uint64_t double_bits(double x) {
+  uint64_t u;
+  std::memcpy(&u, &x, sizeof(u));
+  return u;
+}
+
+inline double bits_double(uint64_t u) {
+  double x;
+  std::memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+/* values: rows x cols, row stride ld */
+void encode_tile(const double* values, size_t ld, int rows, int cols, std::vector<uint8_t>& out) {
+  bit_writer bw;
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < cols; c++) {
+      const uint64_t pred = (c > 0 ? double_bits(values[r * ld + c - 1]) 
+                                   : (r > 0 ? double_bits(values[(r - 1) * ld]) : 0));
+      const uint64_t x = double_bits(values[r * ld + c]) ^ pred;
+      if (x == 0) {
+        bw.put(0, 1);
+        continue;
+      }
+      const int lz = __builtin_clzll(x);
+      const int tz = __builtin_ctzll(x);
+      const int len = 64 - lz - tz;
+      bw.put(1, 1);
+      bw.put(lz, 6);
+      bw.put(len - 1, 6);
+      bw.put(x >> tz, len);
+    }
+  }
+  bw.flush();
+  out.swap(bw.bytes);
+}
+
+void decode_tile(const uint8_t* bytes, size_t size, int rows, int cols, double* values, size_t ld) {
+  bit_reader br(bytes, size);
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < cols; c++) {
+      const uint64_t pred = (c > 0 ? double_bits(values[r * ld + c - 1]) 
+                                   : (r > 0 ? double_bits(values[(r - 1) * ld]) : 0));
+      uint64_t x = 0;
+      if (br.get(1) != 0) {
+        const int lz = br.get(6);
+        const int len = br.get(6) + 1;
+        x = br.get(len) << (64 - lz - len);
+      }
+      values[r * ld + c] = bits_double(x ^ pred);
+    }
+  }
+}
+
+struct container_header {
+  char magic[8];
+  int32_t A, D, tile, reserved;
+  uint64_t num_tiles;
+  uint64_t index_offset;
+};
+
+struct container_info {
+  container_header header;
+  std::vector<uint64_t> index;    // offset, size pairs
+};
+
+/* apply f(k) for k = 0..n-1 on num_threads threads (static blocks) */
+template <typename Func>
+void parallel_for(int n, int num_threads, Func f) {
+  num_threads = std::max(1, std::min(num_threads, n));
+  if (num_threads == 1) {
+    for (int k = 0; k < n; k++)
+      f(k);
+    return;
+  }
+  std::vector<std::thread> workers;
+  for (int t = 0; t < num_threads; t++)
+    workers.emplace_back([&, t] {
+      for (int k = (n * t) / num_threads; k < (n * (t + 1)) / num_threads; k++)
+        f(k);
+    });
+  for (auto& w : workers)
+    w.join();
+}
+
+bool write_container(const char* filename,
+                     int A,
+                     int D,
+                     int num_threads,
+                     const std::vector<std::vector<int>>& dicetuples,
+                     const std::vector<std::vector<int>>& transitions,
+                     const std::vector<std::vector<double>>& probstable,
+                     size_t* bytes_written = nullptr)
+{
+  const int T = 64;
+  const int tiles_d = D / T + 1;
+  const size_t W = static_cast<size_t>(D) + 1;
+
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+    return false;
+
+  container_header h;
+  std::memcpy(h.magic, "DPRKTBL1", 8);
+  h.A = A;
+  h.D = D;
+  h.tile = T;
+  h.reserved = 0;
+  h.num_tiles = static_cast<uint64_t>(A / T + 1) * tiles_d;
+  h.index_offset = 0;
+  out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+  std::vector<uint64_t> index;
+  uint64_t offset = sizeof(h);
+  std::vector<double> band(static_cast<size_t>(T) * W);
+  std::vector<std::vector<uint8_t>> encoded(tiles_d);
+
+  stream_rows(A, D, dicetuples, transitions, probstable,
+              [&](int a, const double* row) {
+                std::copy(row, row + W, band.begin() + static_cast<size_t>(a % T) * W);
+                if (a % T != T - 1 && a != A)
+                  return true;
+                const int rows = a % T + 1;
+                parallel_for(tiles_d, num_threads, [&](int td) {
+                  const int d0 = td * T;
+                  encode_tile(band.data() + d0, W, rows, std::min(T, D + 1 - d0), encoded[td]);
+                });
+                for (int td = 0; td < tiles_d; td++) {
+                  out.write(reinterpret_cast<const char*>(encoded[td].data()), encoded[td].size());
+                  index.push_back(offset);
+                  index.push_back(encoded[td].size());
+                  offset += encoded[td].size();
+                }
+                return true;
+              });
+
+  h.index_offset = offset;
+  out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(uint64_t));
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  if (bytes_written != nullptr)
+    *bytes_written = offset + index.size() * sizeof(uint64_t);
+  return static_cast<bool>(out);
+}
+
+bool read_container_info(const char* filename, container_info& info) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in || !in.read(reinterpret_cast<char*>(&info.header), sizeof(info.header)))
+    return false;
+  const container_header& h = info.header;
+  if (std::memcmp(h.magic, "DPRKTBL1", 8) != 0 || h.A < 0 || h.D < 0 || h.tile < 1)
+    return false;
+  const int tiles_d = h.D / h.tile + 1;
+  if (h.num_tiles != static_cast<uint64_t>(h.A / h.tile + 1) * tiles_d)
+    return false;
+
+  // the index ends the file and every tile lies in the payload; nothing is allocated before this holds
+  in.seekg(0, std::ios::end);
+  const uint64_t file_size = static_cast<uint64_t>(in.tellg());
+  if (!in || h.index_offset < sizeof(h) || h.index_offset > file_size
+      || (file_size - h.index_offset) / (2 * sizeof(uint64_t)) != h.num_tiles
+      || (file_size - h.index_offset) % (2 * sizeof(uint64_t)) != 0)
+    return false;
+  info.index.resize(2 * h.num_tiles);
+  in.seekg(h.index_offset);
+  if (!in.read(reinterpret_cast<char*>(info.index.data()), info.index.size() * sizeof(uint64_t)))
+    return false;
+
+  // every cell costs at least one bit, which bounds the decoded size by the file size
+  for (uint64_t k = 0; k < h.num_tiles; k++) {
+    const uint64_t offset = info.index[2 * k], size = info.index[2 * k + 1];
+    const uint64_t rows = std::min<uint64_t>(h.tile, static_cast<uint64_t>(h.A) + 1 - k / tiles_d * h.tile);
+    const uint64_t cols = std::min<uint64_t>(h.tile, static_cast<uint64_t>(h.D) + 1 - k % tiles_d * h.tile);
+    if (offset < sizeof(h) || offset > h.index_offset || size > h.index_offset - offset || rows * cols > 8 * size)
+      return false;
+  }
+  return true;
+}
+
+/* decode tile (ta, td) into values (row stride ld); returns false on I/O errors */
+bool read_container_tile(std::ifstream& in, const container_info& info, int ta, int td, double* values, size_t ld) {
+  const container_header& h = info.header;
+  const int T = h.tile;
+  const int tiles_d = h.D / T + 1;
+  const size_t k = static_cast<size_t>(ta) * tiles_d + td;
+  std::vector<uint8_t> bytes(info.index[2 * k + 1]);
+  in.seekg(info.index[2 * k]);
+  if (!in.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+    return false;
+  decode_tile(bytes.data(), bytes.size(), std::min(T, h.A + 1 - ta * T), std::min(T, h.D + 1 - td * T), values, ld);
+  return true;
+}
+
+/* decode the whole table into P (a-major, (A + 1) x (D + 1)) with all tiles in parallel */
+bool read_container(const char* filename, const container_info& info, int num_threads, std::vector<double>& P) {
+  const container_header& h = info.header;
+  const int T = h.tile;
+  const int tiles_d = h.D / T + 1;
+  const size_t W = static_cast<size_t>(h.D) + 1;
+  P.assign(static_cast<size_t>(h.A + 1) * W, 0.0);
+
+  const int num_tile_rows = h.A / T + 1;
+  num_threads = std::max(1, std::min(num_threads, num_tile_rows));
+  std::vector<char> ok(num_threads, 1);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < num_threads; t++) {
+    workers.emplace_back([&, t] {
+      std::ifstream in(filename, std::ios::binary);
+      for (int ta = (num_tile_rows * t) / num_threads; ta < (num_tile_rows * (t + 1)) / num_threads; ta++)
+        for (int td = 0; td < tiles_d; td++)
+          if (!in || !read_container_tile(in, info, ta, td, P.data() + ta * T * W + td * T, W))
+            ok[t] = 0;
+    });
+  }
+  for (auto& w : workers)
+    w.join();
+  return std::all_of(ok.begin(), ok.end(), [](char c) { return c != 0; });
+}
+
+/* raw native doubles, no header (numpy.fromfile(..., dtype = float64)) */
+void write_binary(std::ostream& os, const double* x, size_t n) {
+  os.write(reinterpret_cast<const char*>(x), n * sizeof(double));
+}
+
+/*
+  A solved table that can be brought up to date after some rows of
+  probstable have been edited, without solving from scratch. Row q of
+  probstable is used by the cells of its dice regime only, a rectangle with
+  lower corner (a_lo, d_lo) given by dependency_corner(). Since the stencil
+  only moves towards smaller a and d, every cell that can reach that regime
+  lies in [a_lo..A] x [d_lo..D]. After an edit, only the union of these
+  rectangles for the rows that actually changed is recomputed, in the same
+  order and with the same per-cell sum as a full solve, so the result is
+  bit-identical to solving the edited table from scratch.
+*/
+struct dp_table {
+  int A, D;
+  std::vector<std::vector<int>> dicetuples;
+  std::vector<std::vector<int>> transitions;
+  std::vector<std::vector<double>> probstable;
+  std::vector<double> P;      // P[linear_index(a, A, d, D)]
+};
+
+/* lower corner of the region that depends on row q of probstable */
+void dependency_corner(const dp_table& T, int q, int* a_lo, int* d_lo) {
+  *a_lo = T.dicetuples[q][0] + 1;  // attacker_dice(a) = na  <=>  a = na + 1 (or a >= 4 for na = 3)
+  *d_lo = T.dicetuples[q][1];      // defender_dice(d) = nd  <=>  d = nd (or d >= 2 for nd = 2)
+}
+
+/* recompute the cells (a, d) with a >= a_lo[k] and d >= d_lo[k] for some k; returns the count */
+long long recompute_region(dp_table& T, const std::vector<int>& a_lo, const std::vector<int>& d_lo) {
+  int dice_index[4][3];
+  fill_dice_index(T.dicetuples, dice_index);
+
+  const int A = T.A;
+  const int D = T.D;
+  double* data = T.P.data();
+  long long num_updated = 0;
+
+  for (int a = 2; a <= A; a++) {
+    // the region is a staircase: the dirty part of row a is d >= first_d
+    int first_d = D + 1;
+    for (size_t k = 0; k < a_lo.size(); k++)
+      if (a >= a_lo[k] && d_lo[k] < first_d)
+        first_d = d_lo[k];
+    if (first_d < 1)
+      first_d = 1;
+
+    const int na = attacker_dice(a);
+    for (int d = first_d; d <= D; d++) {
+      const int q = dice_index[na][defender_dice(d)];
+      double this_val = 0.0;
+      for (size_t i = 0; i < T.transitions.size(); i++) {
+        const double prob_qi = T.probstable[q][i];
+        if (prob_qi == 0)
+          continue;
+        this_val += prob_qi * data[linear_index(a + T.transitions[i][0], A, d + T.transitions[i][1], D)];
+      }
+      data[linear_index(a, A, d, D)] = this_val;
+      num_updated += 1;
+    }
+  }
+  return num_updated;
+}
+
+bool solve_dp_table(dp_table& T, int A, int D, int uniform_dice_sides) {
+  if (!create_prob_table(T.dicetuples, T.transitions, T.probstable, uniform_dice_sides, false))
+    return false;
+
+  T.A = A;
+  T.D = D;
+  T.P.assign(static_cast<size_t>(1 + A) * (1 + D), 0.0);
+  for (int a = 2; a <= A; a++)
+    T.P[linear_index(a, A, 0, D)] = 1.0;
+
+  recompute_region(T, {0}, {0});
+  return true;
+}
+
+/*
+  Whether probs is a distribution over the outcomes of dicetuple: entries
+  finite and >= 0, summing to 1, and nonzero only for the transitions that
+  lose min(na, nd) units in total (any other one would step outside the
+  region the boundary conditions cover).
+*/
+bool valid_probs_row(const std::vector<int>& dicetuple,
+                     const std::vector<std::vector<int>>& transitions,
+                     const std::vector<double>& probs)
+{
+  if (probs.size() != transitions.size())
+    return false;
+  const int lost = std::min(dicetuple[0], dicetuple[1]);
+  double sum = 0.0;
+  for (size_t i = 0; i < probs.size(); i++) {
+    if (!std::isfinite(probs[i]) || probs[i] < 0.0)
+      return false;
+    if (probs[i] != 0.0 && -(transitions[i][0] + transitions[i][1]) != lost)
+      return false;
+    sum += probs[i];
+  }
+  return std::fabs(sum - 1.0) <= 1e-6;
+}
+
+/*
+  Replace probstable by new_probstable and recompute only what depends on
+  the rows that differ. Returns the number of cells recomputed (0 if
+  nothing changed), or -1 if the new table does not have the same shape
+  or a row is not valid for its dice tuple (see valid_probs_row()).
+*/
+long long update_dp_table(dp_table& T, const std::vector<std::vector<double>>& new_probstable) {
+  if (new_probstable.size() != T.probstable.size())
+    return -1;
+
+  std::vector<int> a_lo, d_lo;
+  for (size_t q = 0; q < new_probstable.size(); q++) {
+    if (!valid_probs_row(T.dicetuples[q], T.transitions, new_probstable[q]))
+      return -1;
+    if (new_probstable[q] == T.probstable[q])
+      continue;
+    int a0, d0;
+    dependency_corner(T, q, &a0, &d0);
+    a_lo.push_back(a0);
+    d_lo.push_back(d0);
+  }
+
+  T.probstable = new_probstable;
+  if (a_lo.empty())
+    return 0;
+  return recompute_region(T, a_lo, d_lo);
+}
+
+/*
+  Output selection for the table writer: the rectangle [a0..a1] x [d0..d1]
+  sampled every stride_a rows and stride_d columns (counted from a0, d0).
+  Only the selected cells are formatted and written, row by row, in the
+  same layout as the full table (a text line, or raw doubles, per row).
+*/
+struct output_selection {
+  int a0, a1, d0, d1;
+  int stride_a, stride_d;
+};
+
+output_selection full_selection(int A, int D) {
+  return output_selection{0, A, 0, D, 1, 1};
+}
+
+inline bool row_selected(const output_selection& S, int a) {
+  return (a >= S.a0 && a <= S.a1 && (a - S.a0) % S.stride_a == 0);
+}
+
+/* row points to P(a, 0..D) (contiguous) */
+void write_selected_row(std::ostream& os,
+                        const double* row,
+                        const output_selection& S,
+                        bool binary,
+                        int num_text_digits)
+{
+  if (binary) {
+    if (S.stride_d == 1) {
+      write_binary(os, row + S.d0, S.d1 - S.d0 + 1);
+      return;
+    }
+    for (int d = S.d0; d <= S.d1; d += S.stride_d)
+      write_binary(os, row + d, 1);
+    return;
+  }
+  os << std::setprecision(num_text_digits);
+  for (int d = S.d0; d <= S.d1; d += S.stride_d)
+    os << row[d] << " ";
+  os << std::endl;
+}
+
+/*
+  Output pipeline that overlaps the solve with formatting and writing. The
+  producer (the solver) hands every selected row to push(), which copies
+  it into a bounded queue and blocks while capacity rows are in flight.
+  num_formatters threads turn queued rows into text (or raw bytes) in
+  parallel, and one writer thread writes the formatted rows in their
+  original order. The wall time approaches max(solve, format / threads,
+  write) instead of the sum. The output is identical to
+  write_selected_row().
+*/
+class output_pipeline {
+public:
+  output_pipeline(std::ostream& os,
+                  const output_selection& sel,
+                  bool binary,
+                  int num_text_digits,
+                  int num_formatters,
+                  int capacity)
+    : os_(os), sel_(sel), binary_(binary), digits_(num_text_digits), capacity_(std::max(1, capacity))
+  {
+    for (int t = 0; t < std::max(1, num_formatters); t++)
+      formatters_.emplace_back([this] { trace_thread_name("formatter"); format_loop(); });
+    writer_ = std::thread([this] { trace_thread_name("writer"); write_loop(); });
+  }
+
+  ~output_pipeline() { finish(); }
+
+  /* row = P(a, 0..D) */
+  void push(const double* row) {
+    std::vector<double> values;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      if (in_flight_ >= capacity_) {
+        trace_span wait("push_wait");
+        space_.wait(lock, [this] { return in_flight_ < capacity_; });
+      }
+      in_flight_ += 1;
+      if (!free_rows_.empty()) {
+        values.swap(free_rows_.back());
+        free_rows_.pop_back();
+      }
+    }
+    values.clear();
+    for (int d = sel_.d0; d <= sel_.d1; d += sel_.stride_d)
+      values.push_back(row[d]);
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      todo_.push_back({next_seq_++, std::move(values)});
+    }
+    work_.notify_one();
+  }
+
+  void finish() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (finished_)
+        return;
+      finished_ = true;
+    }
+    work_.notify_all();
+    for (auto& f : formatters_)
+      f.join();
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      formatters_done_ = true;
+    }
+    ready_.notify_all();
+    writer_.join();
+  }
+
+private:
+  void format_loop() {
+    char buf[32];
+    for (;;) {
+      std::pair<long long, std::vector<double>> item;
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (todo_.empty() && !finished_) {
+          trace_span wait("format_wait");
+          work_.wait(lock, [this] { return !todo_.empty() || finished_; });
+        }
+        if (todo_.empty())
+          return;
+        item = std::move(todo_.front());
+        todo_.pop_front();
+      }
+      trace_span span("format", "row", item.first);
+      std::string text;
+      if (binary_) {
+        text.assign(reinterpret_cast<const char*>(item.second.data()), item.second.size() * sizeof(double));
+      } else {
+        for (double v : item.second) {
+          const int n = std::snprintf(buf, sizeof(buf), "%.*g ", digits_, v);
+          text.append(buf, n);
+        }
+        text.push_back('\n');
+      }
+      span.end();
+      {
+        std::lock_guard<std::mutex> lock(mtx_);
+        done_[item.first] = std::move(text);
+        free_rows_.push_back(std::move(item.second));
+      }
+      ready_.notify_one();
+    }
+  }
+
+  void write_loop() {
+    for (;;) {
+      std::string text;
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        auto can_write = [this] { return done_.count(next_write_) > 0 || (formatters_done_ && done_.empty()); };
+        if (!can_write()) {
+          trace_span wait("write_wait");
+          ready_.wait(lock, can_write);
+        }
+        auto it = done_.find(next_write_);
+        if (it == done_.end())
+          return;
+        text.swap(it->second);
+        done_.erase(it);
+        next_write_ += 1;
+      }
+      {
+        trace_span span("write", "row", next_write_ - 1, "bytes", text.size());
+        os_.write(text.data(), text.size());
+      }
+      {
+        std::lock_guard<std::mutex> lock(mtx_);
+        in_flight_ -= 1;
+      }
+      space_.notify_one();
+    }
+  }
+
+  std::ostream& os_;
+  output_selection sel_;
+  bool binary_;
+  int digits_;
+  int capacity_;
+
+  std::mutex mtx_;
+  std::condition_variable space_, work_, ready_;
+  std::deque<std::pair<long long, std::vector<double>>> todo_;
+  std::map<long long, std::string> done_;
+  std::vector<std::vector<double>> free_rows_;
+  long long next_seq_ = 0;
+  long long next_write_ = 0;
+  int in_flight_ = 0;
+  bool finished_ = false;
+  bool formatters_done_ = false;
+
+  std::vector<std::thread> formatters_;
+  std::thread writer_;
+};
+
+/*
+  Output file writer for large tables: a std::streambuf whose put area is
+  one of depth aligned buffers of buffer_bytes each. A full buffer is
+  submitted as one write at its file offset and the stream continues in
+  the next buffer, so up to depth writes are in flight while the solver
+  keeps producing. On Linux the writes go through io_uring (raw syscalls,
+  the buffers registered once with the ring); with direct = true the file
+  is opened with O_DIRECT (if the file system allows it) and the page
+  cache is bypassed. The last, partial buffer is padded to the alignment
+  and the file truncated to its real size at close(). Where io_uring is not
+  available each buffer is written synchronously with pwrite().
+*/
+class file_writer_buf : public std::streambuf {
+public:
+  file_writer_buf() { }
+  ~file_writer_buf() { close(); }
+
+  bool open(const char* filename, bool direct, int depth = 4, size_t buffer_bytes = 8 << 20) {
+    return open_at(filename, direct, -1, depth, buffer_bytes);
+  }
+
+  /* continue an existing file: keep its first resume_bytes bytes (a negative value truncates to 0) */
+  bool open_at(const char* filename, bool direct, off_t resume_bytes, int depth = 4, size_t buffer_bytes = 8 << 20) {
+    depth_ = std::max(1, depth);
+    buffer_bytes_ = (std::max(buffer_bytes, alignment) / alignment) * alignment;
+    const int flags = O_RDWR | O_CREAT | (resume_bytes < 0 ? O_TRUNC : 0);
+    fd_ = -1;
+    direct_ = false;
+#ifdef O_DIRECT
+    if (direct)
+      fd_ = ::open(filename, flags | O_DIRECT, 0644);
+    direct_ = (fd_ >= 0);
+#endif
+    if (fd_ < 0)
+      fd_ = ::open(filename, flags, 0644);
+    if (fd_ < 0)
+      return false;
+    if (resume_bytes > 0 && (::lseek(fd_, 0, SEEK_END) < resume_bytes || ::ftruncate(fd_, resume_bytes) != 0))
+      return abandon();
+
+    for (int i = 0; i < depth_; i++) {
+      void* p = nullptr;
+      if (posix_memalign(&p, alignment, buffer_bytes_) != 0)
+        return abandon();
+      buffers_.push_back(static_cast<char*>(p));
+    }
+    pending_.assign(depth_, 0);
+    offset_ = 0;
+    current_ = 0;
+    error_ = false;
+    setp(buffers_[0], buffers_[0] + buffer_bytes_);
+    if (resume_bytes > 0) {
+      // start at the last aligned block, which is read back into the first buffer
+      offset_ = resume_bytes / alignment * alignment;
+      const size_t keep = resume_bytes - offset_;
+      if (keep > 0 && ::pread(fd_, buffers_[0], alignment, offset_) < static_cast<ssize_t>(keep))
+        return abandon();
+      pbump(keep);
+    }
+#ifdef DPRISK_HAVE_IO_URING
+    setup_ring();
+#endif
+    return true;
+  }
+
+  /*
+    Write out everything so far and wait until it is on disk (fdatasync);
+    *bytes = the number of bytes written since the file was opened (or the
+    resume point). With O_DIRECT the last partial block is written padded
+    and kept in the buffer to be written again as it fills up.
+  */
+  bool persist(off_t* bytes) {
+    if (fd_ < 0)
+      return false;
+    const size_t tail = pptr() - pbase();
+    const off_t start = offset_;
+    *bytes = start + tail;
+    const size_t keep = (direct_ ? tail % alignment : 0);
+    if (tail > 0) {
+      const size_t padded = (keep > 0 ? tail - keep + alignment : tail);
+      std::memset(pbase() + tail, 0, padded - tail);
+      submit(current_, padded);
+    }
+    for (int i = 0; i < depth_; i++)
+      wait_for(i);
+    if (keep > 0)
+      std::memmove(buffers_[current_], buffers_[current_] + tail - keep, keep);
+    offset_ = start + tail - keep;
+    setp(buffers_[current_], buffers_[current_] + buffer_bytes_);
+    pbump(keep);
+    if (::fdatasync(fd_) != 0)
+      error_ = true;
+    return !error_;
+  }
+
+  /* flush everything, wait for the writes and close; false on any write error */
+  bool close() {
+    if (fd_ < 0)
+      return !error_;
+    const size_t tail = pptr() - pbase();
+    const off_t size = offset_ + tail;
+    if (tail > 0) {
+      // O_DIRECT needs whole blocks; the padding is truncated below
+      const size_t padded = (direct_ ? (tail + alignment - 1) / alignment * alignment : tail);
+      std::memset(pbase() + tail, 0, padded - tail);
+      submit(current_, padded);
+    }
+    for (int i = 0; i < depth_; i++)
+      wait_for(i);
+    if (direct_ && ::ftruncate(fd_, size) != 0)
+      error_ = true;
+    ::close(fd_);
+    fd_ = -1;
+#ifdef DPRISK_HAVE_IO_URING
+    teardown_ring();
+#endif
+    for (char* b : buffers_)
+      std::free(b);
+    buffers_.clear();
+    setp(nullptr, nullptr);
+    return !error_;
+  }
+
+  bool uses_io_uring() const { return ring_fd_ >= 0; }
+  bool uses_direct_io() const { return direct_; }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (fd_ < 0 || error_)
+      return traits_type::eof();
+    submit(current_, pptr() - pbase());
+    current_ = (current_ + 1) % depth_;
+    wait_for(current_);
+    setp(buffers_[current_], buffers_[current_] + buffer_bytes_);
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  // partial buffers cannot be written with O_DIRECT; all data goes out at close()
+  int sync() override { return (error_ ? -1 : 0); }
+
+private:
+  static constexpr size_t alignment = 4096;
+
+  /* failed open: release the file and the buffers without writing anything */
+  bool abandon() {
+    if (fd_ >= 0)
+      ::close(fd_);
+    fd_ = -1;
+    for (char* b : buffers_)
+      std::free(b);
+    buffers_.clear();
+    setp(nullptr, nullptr);
+    return false;
+  }
+
+  void submit(int i, size_t bytes) {
+    if (bytes == 0)
+      return;
+    trace_span span("io_submit", "bytes", bytes);
+#ifdef DPRISK_HAVE_IO_URING
+    if (ring_fd_ >= 0 && !ring_fallback_) {
+      const unsigned tail = *sq_tail_;
+      const unsigned index = tail & *sq_mask_;
+      io_uring_sqe* sqe = &sqes_[index];
+      std::memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = (registered_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE);
+      sqe->fd = fd_;
+      sqe->addr = reinterpret_cast<uint64_t>(buffers_[i]);
+      sqe->len = bytes;
+      sqe->off = offset_;
+      sqe->buf_index = (registered_ ? i : 0);
+      sqe->user_data = i;
+      sq_array_[index] = index;
+      __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+      if (syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, nullptr, 0) == 1) {
+        pending_[i] = bytes;
+        submitted_offset_[i] = offset_;
+        offset_ += bytes;
+        return;
+      }
+      // not consumed by the kernel: take the entry back and write this buffer with pwrite()
+      __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    }
+#endif
+    write_at(buffers_[i], bytes, offset_);
+    offset_ += bytes;
+  }
+
+  void write_at(const char* p, size_t bytes, off_t offset) {
+    while (bytes > 0) {
+      const ssize_t n = ::pwrite(fd_, p, bytes, offset);
+      if (n <= 0) {
+        error_ = true;
+        return;
+      }
+      p += n;
+      bytes -= n;
+      offset += n;
+    }
+  }
+
+  /* wait until buffer i is no longer being written */
+  void wait_for(int i) {
+#ifdef DPRISK_HAVE_IO_URING
+    if (pending_[i] == 0)
+      return;
+    trace_span span("io_wait");
+    while (pending_[i] > 0) {
+      unsigned head = *cq_head_;
+      if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        if (syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+          error_ = true;
+          return;
+        }
+        continue;
+      }
+      const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+      const int j = cqe.user_data;
+      const size_t done = (cqe.res > 0 ? cqe.res : 0);
+      if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) {
+        // write opcode not supported by this kernel (before 5.6): pwrite() from now on
+        ring_fallback_ = true;
+        write_at(buffers_[j], pending_[j], submitted_offset_[j]);
+      } else if (cqe.res < 0)
+        error_ = true;
+      else if (done < pending_[j])  // short write: finish it synchronously
+        write_at(buffers_[j] + done, pending_[j] - done, submitted_offset_[j] + done);
+      pending_[j] = 0;
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    }
+#else
+    (void) i;
+#endif
+  }
+
+#ifdef DPRISK_HAVE_IO_URING
+  void setup_ring() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    const int fd = syscall(__NR_io_uring_setup, depth_, &params);
+    if (fd < 0)
+      return;  // not available (old kernel, seccomp, ...): pwrite()
+
+    sq_bytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_bytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqe_bytes_ = params.sq_entries * sizeof(io_uring_sqe);
+    sq_ring_ = mmap(nullptr, sq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring_ = mmap(nullptr, cq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(nullptr, sqe_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+      ring_fd_ = fd;
+      sqes_ = (sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqes));
+      teardown_ring();
+      return;
+    }
+    ring_fd_ = fd;
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // registered buffers save the page pinning per write; may fail on a low RLIMIT_MEMLOCK
+    std::vector<iovec> iov(depth_);
+    for (int i = 0; i < depth_; i++)
+      iov[i] = {buffers_[i], buffer_bytes_};
+    registered_ = (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, iov.data(), depth_) == 0);
+    submitted_offset_.assign(depth_, 0);
+  }
+
+  void teardown_ring() {
+    if (ring_fd_ < 0)
+      return;
+    if (sqes_ != nullptr)
+      munmap(sqes_, sqe_bytes_);
+    if (sq_ring_ != MAP_FAILED && sq_ring_ != nullptr)
+      munmap(sq_ring_, sq_bytes_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != nullptr)
+      munmap(cq_ring_, cq_bytes_);
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+    sqes_ = nullptr;
+    sq_ring_ = cq_ring_ = nullptr;
+    registered_ = false;
+    ring_fallback_ = false;
+  }
+
+  void* sq_ring_ = nullptr;
+  void* cq_ring_ = nullptr;
+  size_t sq_bytes_ = 0, cq_bytes_ = 0, sqe_bytes_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+  unsigned *sq_tail_ = nullptr, *sq_mask_ = nullptr, *sq_array_ = nullptr;
+  unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr, *cq_mask_ = nullptr;
+  bool registered_ = false;
+  bool ring_fallback_ = false;  // the ring rejected a write opcode
+  std::vector<off_t> submitted_offset_;
+#endif
+
+  int fd_ = -1;
+  int ring_fd_ = -1;
+  bool direct_ = false;
+  bool error_ = false;
+  int depth_ = 1;
+  size_t buffer_bytes_ = 0;
+  std::vector<char*> buffers_;
+  std::vector<size_t> pending_;  // bytes in flight per buffer
+  int current_ = 0;
+  off_t offset_ = 0;
+};
+
+/*
+  Hardware performance counters (--perf) via perf_event_open(2): cycles,
+  instructions, L1d read misses, LLC misses and branch misses, plus the
+  task clock (CPU nanoseconds, a software event that also works where the
+  PMU is not exposed, e.g. in most VMs). User space only, for the calling
+  thread, and with inherit also for the threads it creates afterwards
+  (their counts are added when they exit). Events that cannot be opened
+  (no PMU, perf_event_paranoid, seccomp) read as -1; available() is false
+  if none could. Counts are scaled up if the kernel multiplexed them.
+*/
+enum perf_event_id { perf_cycles, perf_instructions, perf_l1d_misses, perf_llc_misses, perf_branch_misses,
+                     perf_task_clock, num_perf_events };
+
+const char* perf_event_names[num_perf_events] = {
+  "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "task_clock_ns"
+};
+
+struct perf_values {
+  double v[num_perf_events];
+
+  perf_values() { std::fill(v, v + num_perf_events, -1.0); }
+  double operator[](int e) const { return v[e]; }
+
+  /* this - before, for the events counted in both */
+  perf_values since(const perf_values& before) const {
+    perf_values d;
+    for (int e = 0; e < num_perf_events; e++)
+      if (v[e] >= 0.0 && before.v[e] >= 0.0)
+        d.v[e] = v[e] - before.v[e];
+    return d;
+  }
+  void add(const perf_values& x) {
+    for (int e = 0; e < num_perf_events; e++)
+      if (x.v[e] >= 0.0)
+        v[e] = std::max(0.0, v[e]) + x.v[e];
+  }
+  void subtract(const perf_values& x) {
+    for (int e = 0; e < num_perf_events; e++)
+      if (v[e] >= 0.0 && x.v[e] >= 0.0)
+        v[e] = std::max(0.0, v[e] - x.v[e]);
+  }
+};
+
+class perf_counters {
+public:
+  perf_counters() { std::fill(fd_, fd_ + num_perf_events, -1); }
+  ~perf_counters() { close(); }
+  perf_counters(const perf_counters&) = delete;
+  perf_counters& operator=(const perf_counters&) = delete;
+
+  /* returns available() */
+  bool open(bool inherit = false) {
+    close();
+#ifdef DPRISK_HAVE_PERF_EVENTS
+    const uint32_t types[num_perf_events] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+      PERF_TYPE_SOFTWARE
+    };
+    const uint64_t configs[num_perf_events] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_TASK_CLOCK
+    };
+    for (int e = 0; e < num_perf_events; e++) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[e];
+      attr.config = configs[e];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.inherit = (inherit ? 1 : 0);
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fd_[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+#else
+    (void)inherit;
+#endif
+    return available();
+  }
+
+  void close() {
+    for (int e = 0; e < num_perf_events; e++) {
+      if (fd_[e] >= 0)
+        ::close(fd_[e]);
+      fd_[e] = -1;
+    }
+  }
+
+  bool available() const {
+    return std::any_of(fd_, fd_ + num_perf_events, [](int fd) { return fd >= 0; });
+  }
+  bool has(int e) const { return fd_[e] >= 0; }
+
+  /* counts since the counters were opened */
+  perf_values read() const {
+    perf_values x;
+    for (int e = 0; e < num_perf_events; e++) {
+      uint64_t buf[3];  // value, time enabled, time running
+      if (fd_[e] < 0 || ::read(fd_[e], buf, sizeof(buf)) != static_cast<ssize_t>(sizeof(buf)))
+        continue;
+      x.v[e] = (buf[2] > 0 && buf[2] < buf[1] ? buf[0] * (static_cast<double>(buf[1]) / buf[2])
+                                               : static_cast<double>(buf[0]));
+    }
+    return x;
+  }
+
+private:
+  int fd_[num_perf_events];
+};
+
+/*
+  Per-tile counts of solve_tiled() (--perf with --layout): every worker
+  thread opens its own counters and logs the cells and the counts of each
+  tile it solves.
+*/
+struct perf_tile_sample {
+  int cells;
+  perf_values counts;
+};
+
+struct perf_tile_log {
+  std::vector<std::vector<perf_tile_sample>> threads;  // per worker thread
+};
+
+/*
+  Progress reporting, cooperative cancellation and time budgets for long
+  solves. A solver calls update(cells_done, cells_total) at points where
+  everything done so far is complete (after a row, after a wave of tiles)
+  and stops if it returns false: after cancel has been set (from any
+  thread, or a signal handler), or once deadline_seconds have passed since
+  begin(). Every report_seconds on_progress() receives the cells done, the
+  rate and an estimate of the remaining time.
+*/
+struct solve_progress {
+  long long cells_done;
+  long long cells_total;
+  double elapsed_seconds;
+  double cells_per_second;
+  double eta_seconds;
+};
+
+struct solve_control {
+  std::atomic<bool> cancel{false};
+  double deadline_seconds = -1.0;   // negative: no limit
+  double report_seconds = -1.0;     // negative: no reports
+  std::function<void(const solve_progress&)> on_progress;
+
+  bool deadline_reached = false;
+  std::chrono::steady_clock::time_point start, last_report;
+
+  void begin() {
+    start = last_report = std::chrono::steady_clock::now();
+    deadline_reached = false;
+  }
+
+  bool update(long long cells_done, long long cells_total) {
+    if (cancel.load(std::memory_order_relaxed))
+      return false;
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - start).count();
+    if (report_seconds >= 0.0 && on_progress &&
+        std::chrono::duration<double>(now - last_report).count() >= report_seconds) {
+      const double rate = (elapsed > 0.0 ? cells_done / elapsed : 0.0);
+      on_progress({cells_done, cells_total, elapsed, rate,
+                   (rate > 0.0 ? (cells_total - cells_done) / rate : -1.0)});
+      last_report = now;
+    }
+    if (deadline_seconds >= 0.0 && elapsed >= deadline_seconds) {
+      deadline_reached = (cells_done < cells_total);
+      return !deadline_reached;
+    }
+    return true;
+  }
+};
+
+void print_progress(std::ostream& os, const solve_progress& p) {
+  os << "progress: " << p.cells_done << " / " << p.cells_total << " cells ("
+     << std::fixed << std::setprecision(1) << 100.0 * p.cells_done / std::max(1LL, p.cells_total) << "%), "
+     << std::scientific << std::setprecision(3) << p.cells_per_second << " cells/s, eta "
+     << std::fixed << std::setprecision(1) << p.eta_seconds << " s" << std::endl;
+  os.unsetf(std::ios::floatfield);
+}
+
+/* on_row for stream_rows() that also reports row a (so rows 0..a are complete) to C */
+template <typename RowFunc>
+auto controlled_rows(solve_control& C, int A, int D, RowFunc on_row) {
+  return [&C, A, D, on_row](int a, const double* row) mutable {
+    if (!on_row(a, row))
+      return false;
+    return C.update(static_cast<long long>(a + 1) * (D + 1), static_cast<long long>(A + 1) * (D + 1));
+  };
+}
+
+/*
+  Storage layouts for the full (A + 1) x (D + 1) table. A layout maps a
+  cell to a size_t offset (operator()) and gives the size of the storage
+  to allocate (size()), which can be larger than the number of cells.
+    layout_d_major   (1 + A) * d + a, the same as linear_index()
+    layout_a_major   (1 + D) * a + d, rows as written to the output
+    layout_skewed    anti-diagonals s = a + d stored one after another, a
+                     increasing within a diagonal; the cells of a diagonal
+                     do not depend on each other, so solve_tiled() sweeps
+                     them as contiguous vector loops
+    layout_morton    Z-order: the low bits of a and d interleaved, and the
+                     remaining high bits of the longer side on top; a
+                     power-of-two block of cells is contiguous (padded to a
+                     power of two per side, so up to 4x the cells)
+  rows_contiguous is true if row a is stored at [(D + 1) a, (D + 1)(a + 1)),
+  which lets first_touch_tiles() place whole tile rows.
+*/
+struct layout_d_major {
+  int A, D;
+  static const bool diagonal_sweep = false;
+  static const bool rows_contiguous = false;
+  layout_d_major(int A_, int D_) : A(A_), D(D_) { }
+  static const char* name() { return "d-major"; }
+  size_t size() const { return static_cast<size_t>(A + 1) * (D + 1); }
+  size_t operator()(int a, int d) const { return static_cast<size_t>(A + 1) * d + a; }
+};
+
+struct layout_a_major {
+  int A, D;
+  static const bool diagonal_sweep = false;
+  static const bool rows_contiguous = true;
+  layout_a_major(int A_, int D_) : A(A_), D(D_) { }
+  static const char* name() { return "a-major"; }
+  size_t size() const { return static_cast<size_t>(A + 1) * (D + 1); }
+  size_t operator()(int a, int d) const { return static_cast<size_t>(D + 1) * a + d; }
+};
+
+struct layout_skewed {
+  int A, D;
+  std::vector<size_t> start;  // start[s] - max(0, s - D) = offset of (0, s) on diagonal s
+  static const bool diagonal_sweep = true;
+  static const bool rows_contiguous = false;
+  layout_skewed(int A_, int D_) : A(A_), D(D_), start(A_ + D_ + 2) {
+    size_t offset = 0;
+    for (int s = 0; s <= A + D; s++) {
+      const int lo = std::max(0, s - D);
+      const int hi = std::min(A, s);
+      start[s] = offset - lo;
+      offset += hi - lo + 1;
+    }
+    start[A + D + 1] = offset;
+  }
+  static const char* name() { return "skewed"; }
+  size_t size() const { return start[A + D + 1]; }
+  size_t operator()(int a, int d) const { return start[a + d] + a; }
+};
+
+struct layout_morton {
+  int A, D;
+  int bits_a, bits_d, bits_low;
+  static const bool diagonal_sweep = false;
+  static const bool rows_contiguous = false;
+  layout_morton(int A_, int D_) : A(A_), D(D_), bits_a(0), bits_d(0) {
+    while ((1 << bits_a) <= A)
+      bits_a++;
+    while ((1 << bits_d) <= D)
+      bits_d++;
+    bits_low = std::min(bits_a, bits_d);
+  }
+  static const char* name() { return "morton"; }
+  size_t size() const { return static_cast<size_t>(1) << (bits_a + bits_d); }
+  /* 0..0xffffffff -> even bits */
+  static uint64_t spread(uint64_t x) {
+    x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+    x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    x = (x | (x << 2)) & 0x3333333333333333ULL;
+    x = (x | (x << 1)) & 0x5555555555555555ULL;
+    return x;
+  }
+  size_t operator()(int a, int d) const {
+    const uint64_t mask = (static_cast<uint64_t>(1) << bits_low) - 1;
+    const uint64_t high = (static_cast<uint64_t>(a) >> bits_low) | (static_cast<uint64_t>(d) >> bits_low);
+    return (high << (2 * bits_low)) | (spread(a & mask) << 1) | spread(d & mask);
+  }
+};
+
+/*
+  Solve the table stored with layout L into P (L.size() values) in square
+  tiles of tile x tile cells. The stencil reaches back two cells at most,
+  so tile (ta, td) only needs the tiles to its left, above and above-left
+  (for tile >= 2): the tiles of one anti-diagonal wave ta + td = w are
+  independent; tile row ta belongs to thread ta % num_threads in every
+  wave, and the threads meet at a barrier between waves. Within a tile the
+  cells are visited row by row, or diagonal by diagonal for layouts with
+  diagonal_sweep. Each cell sums its terms in the order of stream_rows(),
+  so every layout gives the same bits as the passes. With a control, it is
+  updated after every wave and the solve can stop early. Returns the
+  number of leading rows (0..n - 1) that are complete: A + 1 unless
+  stopped. With a tile_log, the performance counters of every tile are
+  logged (see perf_tile_log).
+*/
+template <typename Layout>
+int solve_tiled(const Layout& L,
+                double* P,
+                int tile,
+                int num_threads,
+                const std::vector<std::vector<int>>& dicetuples,
+                const std::vector<std::vector<int>>& transitions,
+                const std::vector<std::vector<double>>& probstable,
+                solve_control* control = nullptr,
+                perf_tile_log* tile_log = nullptr)
+{
+  const int A = L.A;
+  const int D = L.D;
+  int dice_index[4][3];
+  fill_dice_index(dicetuples, dice_index);
+
+  const int num_transitions = transitions.size();
+  int delta_a[8], delta_d[8];
+  for (int i = 0; i < num_transitions; i++) {
+    delta_a[i] = transitions[i][0];
+    delta_d[i] = transitions[i][1];
+  }
+
+  for (int d = 0; d <= D; d++) {
+    P[L(0, d)] = 0.0;
+    P[L(1, d)] = 0.0;
+  }
+  for (int a = 2; a <= A; a++)
+    P[L(a, 0)] = 1.0;
+
+  // interior [2..A] x [1..D]
+  tile = std::max(2, tile);
+  const int tiles_a = (A - 1 + tile - 1) / tile;
+  const int tiles_d = (D + tile - 1) / tile;
+
+  auto cell = [&](int a, int d) {
+    const double* prob_q = probstable[dice_index[attacker_dice(a)][defender_dice(d)]].data();
+    double this_val = 0.0;
+    for (int i = 0; i < num_transitions; i++) {
+      if (prob_q[i] == 0)
+        continue;
+      this_val += prob_q[i] * P[L(a + delta_a[i], d + delta_d[i])];
+    }
+    P[L(a, d)] = this_val;
+  };
+
+  auto solve_tile = [&](int ta, int td) {
+    const int a0 = 2 + ta * tile;
+    const int a1 = std::min(A, a0 + tile - 1);
+    const int d0 = 1 + td * tile;
+    const int d1 = std::min(D, d0 + tile - 1);
+    if (Layout::diagonal_sweep) {
+      for (int s = a0 + d0; s <= a1 + d1; s++) {
+        const int lo = std::max(a0, s - d1);
+        const int hi = std::min(a1, s - d0);
+        for (int a = lo; a <= hi; a++)
+          cell(a, s - a);
+      }
+    } else {
+      for (int a = a0; a <= a1; a++)
+        for (int d = d0; d <= d1; d++)
+          cell(a, d);
+    }
+  };
+
+  num_threads = std::max(1, num_threads);
+  thread_barrier barrier(num_threads);
+  // first tile row >= ta_lo owned by thread t (tile row ta belongs to thread ta % num_threads)
+  auto tile_owner_offset = [&](int ta_lo, int t) { return ((t - ta_lo) % num_threads + num_threads) % num_threads; };
+
+  const int num_waves = tiles_a + tiles_d - 1;
+  const long long cells_total = static_cast<long long>(A + 1) * (D + 1);
+  long long tiles_done = 0;
+  int waves_done = 0;
+  bool stop = false;
+
+  if (tile_log != nullptr)
+    tile_log->threads.assign(num_threads, {});
+
+  auto worker = [&](int t) {
+    if (t > 0)
+      trace_thread_name("solver");
+    perf_counters counters;
+    if (tile_log != nullptr)
+      counters.open();
+    for (int w = 0; w < num_waves; w++) {
+      const int ta_lo = std::max(0, w - tiles_d + 1);
+      const int ta_hi = std::min(tiles_a - 1, w);
+      // the same owner for a tile row in every wave (see first_touch_tiles())
+      for (int ta = ta_lo + tile_owner_offset(ta_lo, t); ta <= ta_hi; ta += num_threads) {
+        trace_span span("tile", "ta", ta, "td", w - ta);
+        if (tile_log == nullptr) {
+          solve_tile(ta, w - ta);
+          continue;
+        }
+        const perf_values before = counters.read();
+        solve_tile(ta, w - ta);
+        const int a0 = 2 + ta * tile, d0 = 1 + (w - ta) * tile;
+        const int cells = (std::min(A, a0 + tile - 1) - a0 + 1) * (std::min(D, d0 + tile - 1) - d0 + 1);
+        tile_log->threads[t].push_back({cells, counters.read().since(before)});
+      }
+      if (num_threads > 1)
+        barrier.wait();
+      if (control != nullptr) {
+        if (t == 0) {
+          tiles_done += ta_hi - ta_lo + 1;
+          const long long cells = std::min(cells_total, 2LL * (D + 1) + tiles_done * tile * tile);
+          waves_done = w + 1;
+          stop = !control->update(waves_done == num_waves ? cells_total : cells, cells_total);
+        }
+        if (num_threads > 1)
+          barrier.wait();
+        if (stop)
+          break;
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 1; t < num_threads; t++)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for (auto& w : workers)
+    w.join();
+
+  if (control == nullptr || waves_done == num_waves)
+    return A + 1;
+  // tile row ta is complete once wave ta + tiles_d - 1 is done
+  const int rows_done = 2 + std::max(0, waves_done - tiles_d + 1) * tile;
+  return std::min(rows_done, A + 1);
+}
+
+/*
+  Pass the selected rows of a table stored with layout L to on_row(a, row)
+  with row[d] = P(a, d) (only the selected columns are filled in). Rows are
+  gathered block by block (block x block cells at a time) into an a-major
+  buffer, so that for layouts other than a-major the reads stay within a
+  few cache lines per block instead of striding through the whole table.
+*/
+template <typename Layout, typename RowFunc>
+void for_each_layout_row(const Layout& L,
+                         const double* P,
+                         const output_selection& S,
+                         RowFunc on_row)
+{
+  const int block = 64;
+  const int W = L.D + 1;
+  std::vector<double> buffer(static_cast<size_t>(block) * W);
+  std::vector<int> rows;
+
+  for (int a0 = S.a0; a0 <= S.a1; a0 += block) {
+    rows.clear();
+    for (int a = a0; a < a0 + block && a <= S.a1; a++)
+      if (row_selected(S, a))
+        rows.push_back(a);
+    if (rows.empty())
+      continue;
+    for (int d0 = S.d0; d0 <= S.d1; d0 += block) {
+      const int d1 = std::min(S.d1, d0 + block - 1);
+      for (size_t r = 0; r < rows.size(); r++) {
+        double* out = buffer.data() + r * W;
+        for (int d = d0; d <= d1; d++)
+          out[d] = P[L(rows[r], d)];
+      }
+    }
+    for (size_t r = 0; r < rows.size(); r++)
+      on_row(rows[r], static_cast<const double*>(buffer.data() + r * W));
+  }
+}
+
+/*
+  Memory arena for large grids: one anonymous mapping, handed out by bump
+  allocation. Unlike std::vector the memory is not zero-filled by the
+  allocating thread (the kernel supplies zero pages on first touch), so
+  each page ends up on the NUMA node of the thread that first writes it;
+  see first_touch_tiles(). The page size is chosen with page_mode:
+    page_normal        4 KB pages
+    page_transparent   transparent huge pages (madvise(MADV_HUGEPAGE))
+    page_huge          explicit huge pages (MAP_HUGETLB) from the reserved
+                       pool, falling back to transparent ones if the pool
+                       is too small
+  Huge pages cut the TLB misses of the strided stencil reads by covering
+  2 MB per entry instead of 4 KB.
+*/
+enum page_mode { page_normal, page_transparent, page_huge };
+
+struct arena_page_stats {
+  page_mode mode;
+  size_t bytes;                 // size of the mapping
+  size_t rss_kb;                // resident (from /proc/self/smaps)
+  size_t anon_huge_kb;          // of which transparent huge pages
+  size_t hugetlb_kb;            // explicit huge pages
+  std::vector<long> node_pages; // sampled pages per NUMA node (empty if unknown)
+};
+
+class grid_arena {
+public:
+  grid_arena() { }
+  ~grid_arena() { release(); }
+  grid_arena(const grid_arena&) = delete;
+  grid_arena& operator=(const grid_arena&) = delete;
+
+  bool reserve(size_t bytes, page_mode mode) {
+    release();
+    const size_t huge = 2 << 20;
+    bytes = (std::max<size_t>(bytes, 1) + huge - 1) / huge * huge;
+    void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (mode == page_huge)
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) {
+      if (mode == page_huge)
+        mode = page_transparent;
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED)
+        return false;
+#ifdef MADV_HUGEPAGE
+      madvise(p, bytes, (mode == page_transparent ? MADV_HUGEPAGE : MADV_NOHUGEPAGE));
+#else
+      mode = page_normal;
+#endif
+    }
+    base_ = static_cast<char*>(p);
+    capacity_ = bytes;
+    used_ = 0;
+    mode_ = mode;
+    return true;
+  }
+
+  /* nullptr if the arena is full */
+  void* allocate(size_t bytes, size_t align = 64) {
+    const size_t offset = (used_ + align - 1) / align * align;
+    if (base_ == nullptr || offset + bytes > capacity_)
+      return nullptr;
+    used_ = offset + bytes;
+    return base_ + offset;
+  }
+
+  double* allocate_doubles(size_t n) { return static_cast<double*>(allocate(n * sizeof(double))); }
+
+  /* the nominal page size of the mapping */
+  size_t page_bytes() const { return (mode_ == page_normal ? 4096 : 2 << 20); }
+
+  void release() {
+    if (base_ != nullptr)
+      munmap(base_, capacity_);
+    base_ = nullptr;
+    capacity_ = used_ = 0;
+  }
+
+  /* page statistics of the mapping; node counts from up to max_samples pages */
+  bool page_stats(arena_page_stats& st, size_t max_samples = 4096) const {
+    if (base_ == nullptr)
+      return false;
+    st.mode = mode_;
+    st.bytes = capacity_;
+    st.rss_kb = st.anon_huge_kb = st.hugetlb_kb = 0;
+    st.node_pages.clear();
+
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool inside = false;
+    while (std::getline(smaps, line)) {
+      uintptr_t lo, hi;
+      char dash;
+      std::istringstream ls(line);
+      if (line.find(':') == std::string::npos || line.find('-') < line.find(':')) {
+        if ((ls >> std::hex >> lo >> dash >> hi) && dash == '-') {
+          inside = (lo <= reinterpret_cast<uintptr_t>(base_) && reinterpret_cast<uintptr_t>(base_) < hi);
+          continue;
+        }
+      }
+      if (!inside)
+        continue;
+      std::string key;
+      size_t kb = 0;
+      ls.clear();
+      ls.str(line);
+      ls >> key >> kb;
+      if (key == "Rss:")
+        st.rss_kb += kb;
+      else if (key == "AnonHugePages:")
+        st.anon_huge_kb += kb;
+      else if (key == "Private_Hugetlb:" || key == "Shared_Hugetlb:")
+        st.hugetlb_kb += kb;
+    }
+
+#ifdef __NR_move_pages
+    // move_pages() with no target nodes only reports where each page is
+    const size_t page = 4096;
+    const size_t num_pages = capacity_ / page;
+    const size_t step = std::max<size_t>(1, (num_pages + max_samples - 1) / max_samples);
+    std::vector<void*> pages;
+    for (size_t i = 0; i < num_pages; i += step)
+      pages.push_back(base_ + i * page);
+    std::vector<int> status(pages.size(), -1);
+    if (syscall(__NR_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) == 0) {
+      for (int node : status) {
+        if (node < 0)
+          continue;  // not touched (yet)
+        if (node >= static_cast<int>(st.node_pages.size()))
+          st.node_pages.resize(node + 1, 0);
+        st.node_pages[node] += 1;
+      }
+    }
+#endif
+    return true;
+  }
+
+private:
+  char* base_ = nullptr;
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+  page_mode mode_ = page_normal;
+};
+
+/*
+  First touch of a freshly reserved table, page by page (page_bytes: the
+  page size of the arena). With a layout whose rows are contiguous
+  (a-major) each page is written by the thread that owns, in
+  solve_tiled(), the tile row of the first cell on the page (tile row ta
+  belongs to thread ta % num_threads), so that with the threads spread
+  over the NUMA nodes a tile row lives on the node that computes it, up to
+  the pages it shares with the next tile row. A tile row smaller than a
+  page (huge pages, narrow tables) shares all of its pages that way. The
+  other layouts interleave the tile rows of different owners within a
+  page; their table is written in one contiguous block per thread, which
+  spreads it over the nodes but does not place it. The threads are not
+  pinned either, so placement also depends on the scheduler keeping each
+  thread on its node.
+*/
+template <typename Layout>
+void first_touch_tiles(const Layout& L, double* P, int tile, int num_threads, size_t page_bytes = 4096) {
+  tile = std::max(2, tile);
+  num_threads = std::max(1, num_threads);
+  const int tiles_a = (L.A - 1 + tile - 1) / tile;
+  const size_t bytes = L.size() * sizeof(double);
+  char* base = reinterpret_cast<char*>(P);
+  const size_t skew = reinterpret_cast<uintptr_t>(base) % page_bytes;  // P need not start a page
+  const size_t num_pages = (skew + bytes + page_bytes - 1) / page_bytes;
+
+  auto owner = [&](size_t k) {
+    if (!Layout::rows_contiguous)
+      return static_cast<int>(k * num_threads / num_pages);
+    const size_t first_cell = (k * page_bytes > skew ? k * page_bytes - skew : 0) / sizeof(double);
+    const int a = static_cast<int>(first_cell / (L.D + 1));
+    return std::min(tiles_a - 1, std::max(0, a - 2) / tile) % num_threads;
+  };
+
+  auto worker = [&](int t) {
+    for (size_t k = 0; k < num_pages; k++) {
+      if (owner(k) != t)
+        continue;
+      const size_t lo = (k * page_bytes > skew ? k * page_bytes - skew : 0);
+      const size_t hi = std::min(bytes, (k + 1) * page_bytes - skew);
+      std::memset(base + lo, 0, hi - lo);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 1; t < num_threads; t++)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for (auto& w : workers)
+    w.join();
+}
+
+/*
+  Checkpoint of a streamed solve whose rows go to an output file. The
+  stencil only reads the two previous rows, so those rows, the number of
+  completed rows and the length of the output written for them are all
+  that is needed to continue; the checkpoint is O(D) whatever the size of
+  the table. The parameters (A, D, output selection and format, and a
+  fingerprint of probstable) must match on resume. File layout (native
+  byte order): magic "DPRKCKP1", the fields below up to row2, and an
+  FNV-1a checksum of everything before it. save_row_checkpoint() writes a
+  temporary file and renames it over the old checkpoint, so a checkpoint
+  is either the old one or the new one after a crash. load_row_checkpoint()
+  returns 1 for a valid checkpoint of an (A, D) solve, -1 for a valid one
+  of another size and 0 if there is none or it is damaged.
+*/
+struct row_checkpoint {
+  int32_t A, D;
+  int32_t selection[6];        // a0, a1, d0, d1, stride_a, stride_d
+  int32_t binary;
+  uint64_t probs_fingerprint;
+  int32_t next_a;              // rows 0 .. next_a - 1 are done
+  int64_t output_bytes;        // output written for them
+  std::vector<double> row1;    // P(next_a - 1, 0..D)
+  std::vector<double> row2;    // P(next_a - 2, 0..D)
+};
+
+uint64_t fnv1a(const void* data, size_t n, uint64_t h = 14695981039346656037ULL) {
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+uint64_t probs_fingerprint(const std::vector<std::vector<double>>& probstable) {
+  uint64_t h = fnv1a(nullptr, 0);
+  for (const auto& row : probstable)
+    h = fnv1a(row.data(), row.size() * sizeof(double), h);
+  return h;
+}
+
+void serialize_checkpoint(const row_checkpoint& C, std::string& bytes) {
+  bytes.assign("DPRKCKP1");
+  auto put = [&](const void* p, size_t n) { bytes.append(static_cast<const char*>(p), n); };
+  put(&C.A, sizeof(C.A));
+  put(&C.D, sizeof(C.D));
+  put(C.selection, sizeof(C.selection));
+  put(&C.binary, sizeof(C.binary));
+  put(&C.probs_fingerprint, sizeof(C.probs_fingerprint));
+  put(&C.next_a, sizeof(C.next_a));
+  put(&C.output_bytes, sizeof(C.output_bytes));
+  put(C.row1.data(), C.row1.size() * sizeof(double));
+  put(C.row2.data(), C.row2.size() * sizeof(double));
+  const uint64_t checksum = fnv1a(bytes.data(), bytes.size());
+  put(&checksum, sizeof(checksum));
+}
+
+bool save_row_checkpoint(const char* filename, const row_checkpoint& C) {
+  std::string bytes;
+  serialize_checkpoint(C, bytes);
+  const std::string tmp = std::string(filename) + ".tmp";
+  const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+  bool ok = (::write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+  ok = (::fsync(fd) == 0) && ok;
+  ok = (::close(fd) == 0) && ok;
+  return ok && std::rename(tmp.c_str(), filename) == 0;
+}
+
+int load_row_checkpoint(const char* filename, int A, int D, row_checkpoint& C) {
+  std::ifstream in(filename, std::ios::binary);
+  const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  const size_t fixed = 8 + 2 * sizeof(int32_t) + sizeof(C.selection) + sizeof(int32_t) + 
+                       sizeof(uint64_t) + sizeof(int32_t) + sizeof(int64_t);
+  if (bytes.size() < fixed + sizeof(uint64_t) || bytes.compare(0, 8, "DPRKCKP1") != 0)
+    return 0;
+  size_t pos = 8;
+  auto get = [&](void* p, size_t n) { std::memcpy(p, bytes.data() + pos, n); pos += n; };
+  get(&C.A, sizeof(C.A));
+  get(&C.D, sizeof(C.D));
+  get(C.selection, sizeof(C.selection));
+  get(&C.binary, sizeof(C.binary));
+  get(&C.probs_fingerprint, sizeof(C.probs_fingerprint));
+  get(&C.next_a, sizeof(C.next_a));
+  get(&C.output_bytes, sizeof(C.output_bytes));
+  // the header is checked before any size is computed from it
+  if (C.A < 0 || C.D < 0 || C.next_a < 0 || C.next_a > static_cast<int64_t>(C.A) + 1 ||
+      C.output_bytes < (C.next_a > 0 ? 0 : -1))
+    return 0;
+  const uint64_t row_bytes = (static_cast<uint64_t>(C.D) + 1) * sizeof(double);
+  if (bytes.size() != fixed + 2 * row_bytes + sizeof(uint64_t))
+    return 0;
+  uint64_t checksum;
+  std::memcpy(&checksum, bytes.data() + bytes.size() - sizeof(checksum), sizeof(checksum));
+  if (checksum != fnv1a(bytes.data(), bytes.size() - sizeof(checksum)))
+    return 0;
+  if (C.A != A || C.D != D)
+    return -1;
+  C.row1.resize(C.D + 1);
+  C.row2.resize(C.D + 1);
+  get(C.row1.data(), row_bytes);
+  get(C.row2.data(), row_bytes);
+  return 1;
+}
+
+/*
+  Run statistics (--stats): wall time per named phase, the work done and
+  the resources used, printed by write_run_stats() as one JSON object.
+  phase_timer adds the lifetime of a scope to a phase, less the time that
+  another phase (excluding) accumulated meanwhile, e.g. the output written
+  from within a streamed solve; without a run_stats it only records the
+  phase as a trace span. With perf counters (--perf) it does the same for
+  the counts of each phase.
+*/
+struct run_stats {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::pair<std::string, double>> phases;  // in order of first use
+  std::string engine;
+  int A = 0, D = 0;
+  int threads = 0;
+  long long cells = 0;
+  int passes = 0;
+  uint64_t bytes_written = 0;
+
+  bool want_perf = false;
+  perf_counters* perf = nullptr;  // null if not wanted or not available
+  std::vector<std::pair<std::string, perf_values>> phase_counts;
+  perf_tile_log tiles;  // filled by the tiled solver
+
+  double& phase(const std::string& name) {
+    for (auto& p : phases)
+      if (p.first == name)
+        return p.second;
+    phases.push_back({name, 0.0});
+    return phases.back().second;
+  }
+  perf_values& counts(const std::string& name) {
+    for (auto& p : phase_counts)
+      if (p.first == name)
+        return p.second;
+    perf_values zero;
+    std::fill(zero.v, zero.v + num_perf_events, 0.0);
+    phase_counts.push_back({name, zero});
+    return phase_counts.back().second;
+  }
+};
+
+class phase_timer {
+public:
+  phase_timer(run_stats* st, const char* name, const char* excluding = nullptr)
+    : st_(st), name_(name), excluding_(excluding), span_(name)
+  {
+    if (st_ == nullptr)
+      return;
+    excluded_ = (excluding_ != nullptr ? st_->phase(excluding_) : 0.0);
+    if (st_->perf != nullptr) {
+      if (excluding_ != nullptr)
+        excluded_counts_ = st_->counts(excluding_);
+      counts0_ = st_->perf->read();
+    }
+    t0_ = std::chrono::steady_clock::now();
+  }
+  ~phase_timer() { stop(); }
+
+  /* end the phase before the end of the scope */
+  void stop() {
+    span_.end();
+    if (st_ == nullptr)
+      return;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0_).count();
+    if (excluding_ != nullptr)
+      seconds -= st_->phase(excluding_) - excluded_;
+    st_->phase(name_) += seconds;
+    if (st_->perf != nullptr) {
+      perf_values counts = st_->perf->read().since(counts0_);
+      if (excluding_ != nullptr)
+        counts.subtract(st_->counts(excluding_).since(excluded_counts_));
+      st_->counts(name_).add(counts);
+    }
+    st_ = nullptr;
+  }
+private:
+  run_stats* st_;
+  const char* name_;
+  const char* excluding_;
+  double excluded_ = 0.0;
+  perf_values counts0_, excluded_counts_;
+  std::chrono::steady_clock::time_point t0_;
+  trace_span span_;
+};
+
+/* buffered pass-through streambuf that counts the bytes written to target */
+class counting_buf : public std::streambuf {
+public:
+  explicit counting_buf(std::streambuf* target) : target_(target), buffer_(1 << 16) {
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+  }
+  ~counting_buf() { sync(); }
+
+  uint64_t bytes() const { return flushed_ + (pptr() - pbase()); }
+
+  /* send the rest of the output to a different target; returns the old one */
+  std::streambuf* retarget(std::streambuf* target) {
+    sync();
+    std::swap(target, target_);
+    return target;
+  }
+  std::streambuf* target() const { return target_; }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (drain() != 0)
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+  int sync() override { return (drain() == 0 ? target_->pubsync() : -1); }
+
+private:
+  int drain() {
+    const std::streamsize n = pptr() - pbase();
+    if (n > 0 && target_->sputn(pbase(), n) != n)
+      return -1;
+    flushed_ += n;
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    return 0;
+  }
+
+  std::streambuf* target_;
+  std::vector<char> buffer_;
+  uint64_t flushed_ = 0;
+};
+
+/* peak resident set size of the process in kB */
+long peak_rss_kb() {
+  rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0)
+    return -1;
+  return ru.ru_maxrss;
+}
+
+/* a count as JSON: null if the event was not counted */
+void write_count(std::ostream& os, double x) {
+  if (x < 0.0)
+    os << "null";
+  else
+    os << x;
+}
+
+/*
+  The "counters" of --stats: null without counters, otherwise per phase the
+  counts, the counts per cell (of the table solved) and instructions per
+  cycle, and for tiled solves the p50 / p95 / max over the tiles of the
+  counts per cell.
+*/
+void write_perf_counters(std::ostream& os, const run_stats& st) {
+  if (st.perf == nullptr) {
+    os << "null";
+    return;
+  }
+  auto write_values = [&](const perf_values& x, double scale) {
+    os << "{";
+    for (int e = 0; e < num_perf_events; e++) {
+      os << (e > 0 ? ", " : "") << "\"" << perf_event_names[e] << "\": ";
+      write_count(os, st.perf->has(e) ? x[e] * scale : -1.0);
+    }
+    os << "}";
+  };
+  const double per_cell = (st.cells > 0 ? 1.0 / st.cells : 0.0);
+
+  os << "{\"phases\": {";
+  for (size_t i = 0; i < st.phase_counts.size(); i++) {
+    const perf_values& x = st.phase_counts[i].second;
+    os << (i > 0 ? ", " : "") << "\"" << st.phase_counts[i].first << "\": {\"total\": ";
+    write_values(x, 1.0);
+    os << ", \"per_cell\": ";
+    write_values(x, per_cell);
+    os << ", \"ipc\": ";
+    write_count(os, st.perf->has(perf_cycles) && st.perf->has(perf_instructions) && x[perf_cycles] > 0.0
+                    ? x[perf_instructions] / x[perf_cycles] : -1.0);
+    os << "}";
+  }
+  os << "}";
+
+  std::vector<perf_tile_sample> tiles;
+  for (const auto& samples : st.tiles.threads)
+    tiles.insert(tiles.end(), samples.begin(), samples.end());
+  if (!tiles.empty()) {
+    os << ", \"tiles\": {\"count\": " << tiles.size();
+    for (int e = 0; e < num_perf_events; e++) {
+      std::vector<double> x;
+      for (const perf_tile_sample& t : tiles)
+        if (t.counts[e] >= 0.0 && t.cells > 0)
+          x.push_back(t.counts[e] / t.cells);
+      os << ", \"" << perf_event_names[e] << "_per_cell\": ";
+      if (x.empty()) {
+        os << "null";
+        continue;
+      }
+      std::sort(x.begin(), x.end());
+      os << "{\"p50\": " << x[(x.size() - 1) / 2] << ", \"p95\": " << x[(x.size() - 1) * 95 / 100]
+         << ", \"max\": " << x.back() << "}";
+    }
+    os << "}";
+  }
+  os << "}";
+}
+
+void write_run_stats(std::ostream& os, const run_stats& st) {
+  const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - st.start).count();
+  double solve = 0.0;
+  os << std::setprecision(6) << "{\"engine\": \"" << st.engine << "\", \"A\": " << st.A << ", \"D\": " << st.D
+     << ", \"threads\": " << st.threads << ", \"phases\": {";
+  for (size_t i = 0; i < st.phases.size(); i++) {
+    os << (i > 0 ? ", " : "") << "\"" << st.phases[i].first << "\": " << st.phases[i].second;
+    if (st.phases[i].first == "solve")
+      solve = st.phases[i].second;
+  }
+  os << "}, \"total_s\": " << total << ", \"cells\": " << st.cells
+     << ", \"cells_per_s\": " << (solve > 0.0 ? st.cells / solve : 0.0) << ", \"passes\": " << st.passes
+     << ", \"peak_rss_kb\": " << peak_rss_kb() << ", \"bytes_written\": " << st.bytes_written;
+  if (st.want_perf) {
+    os << ", \"counters\": ";
+    write_perf_counters(os, st);
+  }
+  os << "}" << std::endl;
+}
+
+/*
+  Autotuning (--tune): time short solves of the full table with every
+  candidate configuration (the passes; the scan and the tiled solver on
+  1, 2, 4, ... threads; each layout with tiles of 16..256) on a grid of
+  the same shape scaled down to about tune_cells cells, and keep the
+  fastest. The choice is cached per machine (CPU model and hardware
+  threads) and grid shape (A and D rounded to powers of two) in a small
+  text file, one line per entry:
+    machine shape engine layout tile threads ns_per_cell
+  which later runs read when --engine, --layout, --tile and --threads are
+  not given and the run is neither controlled nor pipelined (see main()).
+*/
+struct tune_config {
+  std::string engine = "passes";  // "passes", "scan" or "tiled"
+  std::string layout = "-";       // for "tiled"
+  int tile = 64;
+  int threads = 1;
+  double ns_per_cell = 0.0;
+};
+
+const long long tune_cells = 1 << 20;
+
+/* the passes solver as run by dprisk (P is d-major) */
+bool solve_passes(int A,
+                  int D,
+                  const std::vector<std::vector<int>>& dicetuples,
+                  const std::vector<std::vector<int>>& transitions,
+                  const std::vector<std::vector<double>>& probstable,
+                  std::vector<double>& P)
+{
+  const double unused_value = -1.0;
+  P.assign((1 + A) * (1 + D), unused_value);
+  for (int j = 0; j <= D; j++) {
+    P[linear_index(0, A, j, D)] = 0.0;
+    P[linear_index(1, A, j, D)] = 0.0;
+  }
+  for (int i = 2; i <= A; i++)
+    P[linear_index(i, A, 0, D)] = 1.0;
+
+  int elems_total = 0;
+  for (;;) {
+    const int elems = update_elements(A, D, P, unused_value, dicetuples, transitions, probstable);
+    if (elems == 0)
+      break;
+    elems_total += elems;
+  }
+  return elems_total == (A - 1) * D;
+}
+
+std::string tune_machine_key() {
+  std::ifstream in("/proc/cpuinfo");
+  std::string line, model = "unknown";
+  while (std::getline(in, line))
+    if (line.compare(0, 10, "model name") == 0) {
+      model = line.substr(line.find(':') + 1);
+      break;
+    }
+  std::ostringstream key;
+  key << std::hex << fnv1a(model.data(), model.size()) << std::dec << "x" << std::thread::hardware_concurrency();
+  return key.str();
+}
+
+std::string tune_shape_key(int A, int D) {
+  auto log2_floor = [](int n) { int k = 0; while (n >>= 1) k++; return k; };
+  return "a" + std::to_string(log2_floor(A)) + "d" + std::to_string(log2_floor(D));
+}
+
+bool load_tune_config(const char* filename, const std::string& machine, const std::string& shape, tune_config& c) {
+  std::ifstream in(filename);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string m, s;
+    tune_config t;
+    if (fields >> m >> s >> t.engine >> t.layout >> t.tile >> t.threads >> t.ns_per_cell &&
+        m == machine && s == shape) {
+      c = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* replace (or add) the entry for machine and shape */
+bool save_tune_config(const char* filename, const std::string& machine, const std::string& shape, const tune_config& c) {
+  std::vector<std::string> lines;
+  {
+    std::ifstream in(filename);
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      std::string m, s;
+      if (!(fields >> m >> s) || m != machine || s != shape)
+        lines.push_back(line);
+    }
+  }
+  std::ostringstream entry;
+  entry << machine << " " << shape << " " << c.engine << " " << c.layout << " " << c.tile << " " << c.threads
+        << " " << std::setprecision(4) << c.ns_per_cell;
+  lines.push_back(entry.str());
+
+  const std::string tmp = std::string(filename) + ".tmp";
+  {
+    std::ofstream out(tmp);
+    for (const std::string& line : lines)
+      out << line << "\n";
+    if (!out.flush())
+      return false;
+  }
+  return std::rename(tmp.c_str(), filename) == 0;
+}
+
+/* time the candidates for an A x D grid; prints "engine layout tile threads ns_per_cell" lines to report */
+tune_config autotune(int A,
+                     int D,
+                     int max_threads,
+                     const std::vector<std::vector<int>>& dicetuples,
+                     const std::vector<std::vector<int>>& transitions,
+                     const std::vector<std::vector<double>>& probstable,
+                     std::ostream& report)
+{
+  const double cells = static_cast<double>(A + 1) * (D + 1);
+  if (cells > tune_cells) {
+    const double f = std::sqrt(tune_cells / cells);
+    A = std::max(2, static_cast<int>(A * f));
+    D = std::max(1, static_cast<int>(D * f));
+  }
+  const double n = static_cast<double>(A + 1) * (D + 1);
+
+  std::vector<int> thread_counts;
+  for (int t = 1; t < max_threads; t *= 2)
+    thread_counts.push_back(t);
+  thread_counts.push_back(max_threads);
+
+  tune_config best;
+  best.ns_per_cell = -1.0;
+  // best of three runs after a warmup; a candidate whose solve fails is reported and skipped
+  auto measure = [&](tune_config c, auto solve) {
+    double seconds = 1e300;
+    for (int rep = 0; rep < 4; rep++) {
+      const auto t0 = std::chrono::steady_clock::now();
+      if (!solve()) {
+        report << c.engine << " " << c.layout << " " << c.tile << " " << c.threads << " failed" << std::endl;
+        return;
+      }
+      if (rep > 0)
+        seconds = std::min(seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    }
+    c.ns_per_cell = seconds * 1e9 / n;
+    report << c.engine << " " << c.layout << " " << c.tile << " " << c.threads << " "
+           << std::setprecision(4) << c.ns_per_cell << std::endl;
+    if (best.ns_per_cell < 0.0 || c.ns_per_cell < best.ns_per_cell)
+      best = c;
+  };
+
+  std::vector<double> P;
+  double sink = 0.0;
+  tune_config c;
+  c.threads = max_threads;  // the passes are sequential; the threads are left to the output
+  measure(c, [&] { return solve_passes(A, D, dicetuples, transitions, probstable, P); });
+
+  c.engine = "scan";
+  for (int t : thread_counts) {
+    c.threads = t;
+    measure(c, [&] {
+      return solve_columns_scan(A, D, dicetuples, transitions, probstable, t,
+                                [&](int d, const double* column) { sink += column[A]; return true; });
+    });
+  }
+
+  c.engine = "tiled";
+  auto tiled = [&](const auto& L) {
+    c.layout = L.name();
+    // allocated and touched once, outside the timed solves (as the passes reuse P)
+    grid_arena arena;
+    double* Q = (arena.reserve(L.size() * sizeof(double), page_normal) ? arena.allocate_doubles(L.size()) : nullptr);
+    if (Q == nullptr) {
+      report << c.engine << " " << c.layout << " - - failed" << std::endl;
+      return;
+    }
+    std::fill(Q, Q + L.size(), 0.0);
+    for (int tile = 16; tile <= 256; tile *= 2)
+      for (int t : thread_counts) {
+        c.tile = tile;
+        c.threads = t;
+        measure(c, [&] {
+          solve_tiled(L, Q, tile, t, dicetuples, transitions, probstable);
+          sink += Q[L(A, D)];
+          return true;
+        });
+      }
+  };
+  tiled(layout_d_major(A, D));
+  tiled(layout_a_major(A, D));
+  tiled(layout_skewed(A, D));
+  tiled(layout_morton(A, D));
+
+  if (sink == 12345.0)
+    report << sink << std::endl;  // keeps the solves from being optimized away
+  return best;
+}
+
+/* "a0:a1,d0:d1" */
+bool parse_rectangle(const char* str, output_selection& S) {
+  return (std::sscanf(str, "%d:%d,%d:%d", &S.a0, &S.a1, &S.d0, &S.d1) == 4);
+}
+
+std::vector<double> parse_list(const char* str) {
+  std::vector<double> values;
+  const char* s = str;
+  while (*s != '\0') {
+    char* end = nullptr;
+    const double v = std::strtod(s, &end);
+    if (end == s)
+      break;
+    values.push_back(v);
+    s = (*end == ',' ? end + 1 : end);
+  }
+  return values;
+}
+
+/* die face weights: at least one, all finite and >= 0, with a positive total */
+bool valid_face_weights(const std::vector<double>& w) {
+  double total = 0.0;
+  for (double x : w) {
+    if (!std::isfinite(x) || x < 0.0)
+      return false;
+    total += x;
+  }
+  return !w.empty() && std::isfinite(total) && total > 0.0;
+}
+
+#ifndef DPRISK_NO_MAIN
+
+/* SIGINT / SIGTERM ask a controlled solve to stop cleanly */
+static std::atomic<bool>* interrupt_flag = nullptr;
+
+extern "C" void on_interrupt(int) {
+  if (interrupt_flag != nullptr)
+    interrupt_flag->store(true);
+}
+
+int main(int argc, char** argv) {
+
+  const int num_text_digits = 16;
+  const int uniform_dice_sides = 6;
+
+  std::vector<const char*> args;
+  std::vector<double> threshold_levels;
+  bool want_contour = false;
+  bool want_outcomes = false;
+  bool want_binary = false;
+  int rounds_truncation = -1;
+  bool want_sensitivity = false;
+  std::vector<double> attacker_faces;
+  std::vector<double> defender_faces;
+  const char* variants_file = nullptr;
+  std::vector<std::pair<int, std::vector<double>>> edits;
+  int num_threads = 0;
+  std::string engine = "passes";
+  bool want_cell = false;
+  int approx_limit = -1;
+  double surface_tolerance = -1.0;
+  double compress_eps = -1.0;
+  const char* container_file = nullptr;
+  const char* decode_file = nullptr;
+  output_selection selection = {0, -1, 0, -1, 1, 1};
+  bool select_last_row = false;
+  bool select_last_col = false;
+  bool has_selection = false;
+  bool want_pipeline = false;
+  const char* output_file = nullptr;
+  bool want_direct_io = false;
+  std::string layout_name;
+  int tile_size = 64;
+  bool want_layout_bench = false;
+  page_mode grid_pages = page_normal;
+  bool want_page_stats = false;
+  const char* checkpoint_file = nullptr;
+  double checkpoint_seconds = 60.0;
+  bool want_resume = false;
+  double progress_seconds = -1.0;
+  double deadline_seconds = -1.0;
+  bool want_stats = false;
+  const char* stats_file = nullptr;
+  bool want_perf = false;
+  const char* trace_file = nullptr;
+  bool want_tune = false;
+  const char* tune_file = ".dprisk-tune";
+  bool explicit_config = false;  // --engine, --layout, --tile or --threads given
+
+  for (int i = 1; i < argc; i++) {
+    const std::string opt = argv[i];
+    if (opt == "--thresholds" && i + 1 < argc) {
+      threshold_levels = parse_list(argv[++i]);
+    } else if (opt == "--contour") {
+      want_contour = true;
+    } else if (opt == "--outcomes") {
+      want_outcomes = true;
+    } else if (opt == "--rounds" && i + 1 < argc) {
+      rounds_truncation = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+      if (rounds_truncation < 0) {
+        args.clear();
+        break;
+      }
+    } else if (opt == "--binary") {
+      want_binary = true;
+    } else if (opt == "--variants" && i + 1 < argc) {
+      variants_file = argv[++i];
+    } else if (opt == "--approx" && i + 1 < argc) {
+      approx_limit = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+    } else if (opt == "--surface" && i + 1 < argc) {
+      surface_tolerance = std::strtod(argv[++i], nullptr);
+    } else if (opt == "--compress" && i + 1 < argc) {
+      compress_eps = std::strtod(argv[++i], nullptr);
+    } else if (opt == "--container" && i + 1 < argc) {
+      container_file = argv[++i];
+    } else if (opt == "--decode" && i + 1 < argc) {
+      decode_file = argv[++i];
+    } else if (opt == "--rect" && i + 1 < argc) {
+      if (!parse_rectangle(argv[++i], selection)) {
+        args.clear();
+        break;
+      }
+      has_selection = true;
+    } else if (opt == "--stride" && i + 1 < argc) {
+      const std::vector<double> k = parse_list(argv[++i]);
+      if (k.empty() || k[0] < 1 || (k.size() > 1 && k[1] < 1)) {
+        args.clear();
+        break;
+      }
+      selection.stride_a = static_cast<int>(k[0]);
+      selection.stride_d = static_cast<int>(k.size() > 1 ? k[1] : k[0]);
+      has_selection = true;
+    } else if (opt == "--last-row") {
+      select_last_row = has_selection = true;
+    } else if (opt == "--last-col") {
+      select_last_col = has_selection = true;
+    } else if (opt == "--corner") {
+      select_last_row = select_last_col = has_selection = true;
+    } else if (opt == "--pipeline") {
+      want_pipeline = true;
+    } else if (opt == "--output" && i + 1 < argc) {
+      output_file = argv[++i];
+    } else if (opt == "--direct") {
+      want_direct_io = true;
+    } else if (opt == "--layout" && i + 1 < argc) {
+      layout_name = argv[++i];
+      explicit_config = true;
+    } else if (opt == "--tile" && i + 1 < argc) {
+      tile_size = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+      explicit_config = true;
+    } else if (opt == "--layout-bench") {
+      want_layout_bench = true;
+    } else if (opt == "--pages" && i + 1 < argc) {
+      const std::string mode = argv[++i];
+      if (mode != "normal" && mode != "transparent" && mode != "huge") {
+        args.clear();
+        break;
+      }
+      grid_pages = (mode == "huge" ? page_huge : (mode == "transparent" ? page_transparent : page_normal));
+    } else if (opt == "--page-stats") {
+      want_page_stats = true;
+    } else if (opt == "--checkpoint" && i + 1 < argc) {
+      checkpoint_file = argv[++i];
+    } else if (opt == "--checkpoint-every" && i + 1 < argc) {
+      checkpoint_seconds = std::strtod(argv[++i], nullptr);
+    } else if (opt == "--resume") {
+      want_resume = true;
+    } else if (opt == "--progress" && i + 1 < argc) {
+      progress_seconds = std::strtod(argv[++i], nullptr);
+    } else if (opt == "--deadline" && i + 1 < argc) {
+      deadline_seconds = std::strtod(argv[++i], nullptr);
+    } else if (opt == "--stats") {
+      want_stats = true;
+    } else if (opt == "--stats-file" && i + 1 < argc) {
+      want_stats = true;
+      stats_file = argv[++i];
+    } else if (opt == "--perf") {
+      want_stats = want_perf = true;
+    } else if (opt == "--trace" && i + 1 < argc) {
+      trace_file = argv[++i];
+    } else if (opt == "--tune") {
+      want_tune = true;
+    } else if (opt == "--tune-file" && i + 1 < argc) {
+      tune_file = argv[++i];
+    } else if (opt == "--cell") {
+      want_cell = true;
+    } else if (opt == "--engine" && i + 1 < argc) {
+      engine = argv[++i];
+      explicit_config = true;
+    } else if (opt == "--threads" && i + 1 < argc) {
+      num_threads = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+      explicit_config = true;
+    } else if (opt == "--edit" && i + 1 < argc) {
+      const char* spec = argv[++i];
+      const char* colon = std::strchr(spec, ':');
+      if (colon == nullptr) {
+        args.clear();
+        break;
+      }
+      edits.push_back({std::atoi(spec), parse_list(colon + 1)});
+    } else if (opt == "--sensitivity") {
+      want_sensitivity = true;
+    } else if (opt == "--attacker-die" && i + 1 < argc) {
+      attacker_faces = parse_list(argv[++i]);
+      if (!valid_face_weights(attacker_faces)) {
+        args.clear();
+        break;
+      }
+    } else if (opt == "--defender-die" && i + 1 < argc) {
+      defender_faces = parse_list(argv[++i]);
+      if (!valid_face_weights(defender_faces)) {
+        args.clear();
+        break;
+      }
+    } else if (opt.compare(0, 2, "--") == 0) {
+      args.clear();
+      break;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+
+  if (num_threads < 1)
+    num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+  if (decode_file != nullptr && args.empty()) {
+    container_info info;
+    std::vector<double> P;
+    if (!read_container_info(decode_file, info) || !read_container(decode_file, info, num_threads, P)) {
+      std::cout << "failed to read container: " << decode_file << std::endl;
+      return 1;
+    }
+    const int A = info.header.A;
+    const int D = info.header.D;
+    if (want_binary) {
+      write_binary(std::cout, P.data(), P.size());
+      return 0;
+    }
+    for (int a = 0; a <= A; a++) {
+      for (int d = 0; d <= D; d++) {
+        std::cout << std::setprecision(num_text_digits) << P[static_cast<size_t>(a) * (D + 1) + d] << " ";
+      }
+      std::cout << std::endl;
+    }
+    return 0;
+  }
+
+  if (args.size() != 2 && args.size() != 3) {
+    std::cout << "usage: " << argv[0] << " attackers defenders [samples]"
+              << " [--thresholds p1,p2,...] [--contour] [--outcomes] [--rounds K] [--binary]"
+              << " [--sensitivity] [--attacker-die w1,...] [--defender-die w1,...]"
+              << " [--variants file] [--threads T] [--edit q:p0,p1,p2,p3,p4]"
+              << " [--engine passes|scan] [--cell] [--approx L] [--surface tol]"
+              << " [--compress eps] [--container file]"
+              << " [--rect a0:a1,d0:d1] [--stride k[,kd]] [--last-row] [--last-col] [--corner]"
+              << " [--pipeline] [--output file] [--direct]"
+              << " [--layout d-major|a-major|skewed|morton] [--tile T] [--layout-bench]"
+              << " [--pages normal|transparent|huge] [--page-stats]"
+              << " [--checkpoint file] [--checkpoint-every seconds] [--resume]"
+              << " [--progress seconds] [--deadline seconds] [--stats] [--stats-file file] [--perf]"
+              << " [--trace file] [--tune] [--tune-file file]" << std::endl;
+    std::cout << "       " << argv[0] << " --decode file [--binary] [--threads T]" << std::endl;
+    return 1;
+  }
+
+  long int tmp = std::strtol(args[0], nullptr, 0);
+  int A = static_cast<int>(tmp);
+
+  tmp = std::strtol(args[1], nullptr, 0);
+  int D = static_cast<int>(tmp);
+
+  int N = 0;
+  if (args.size() > 2) {
+    tmp = std::strtol(args[2], nullptr, 0);
+    N = static_cast<int>(tmp);    
+  }
+
+  if (A < 2 || D < 1) {
+    std::cout << "requiring: A >= 2 and D >= 1" << std::endl;
+    return 1;
+  }
+
+  // timeline of the run, written at exit (after the output file is closed)
+  tracer trace;
+  struct trace_writer {
+    tracer* trace;
+    const char* file;
+    ~trace_writer() {
+      if (file == nullptr)
+        return;
+      trace->end();
+      std::ofstream out(file);
+      trace->write_json(out);
+      if (!out)
+        std::cerr << "failed to write the trace file: " << file << std::endl;
+      else if (trace->dropped() > 0)
+        std::cerr << "trace: " << trace->dropped() << " events lost to full ring buffers" << std::endl;
+    }
+  } trace_out = {&trace, trace_file};
+  if (trace_file != nullptr) {
+    trace.begin();
+    trace_thread_name("main");
+  }
+
+  // from here on standard output goes to the output file (restored and closed on return)
+  file_writer_buf output_buf;
+  struct output_redirect {
+    std::streambuf* saved = nullptr;
+    file_writer_buf* buf = nullptr;
+    bool closed = false;
+    /* flush and close the output file; false on any write error */
+    bool close() {
+      if (buf == nullptr || closed)
+        return true;
+      closed = true;
+      std::cout.flush();
+      if (buf->close())
+        return true;
+      std::cerr << "error writing the output file" << std::endl;
+      return false;
+    }
+    ~output_redirect() {
+      if (buf == nullptr)
+        return;
+      close();
+      std::cout.rdbuf(saved);
+    }
+  } redirect;
+  // exit status of a run whose output is complete: 1 if the output file could not be written
+  auto finish_output = [&](int status) { return (redirect.close() ? status : 1); };
+  if (output_file != nullptr && checkpoint_file == nullptr) {
+    if (!output_buf.open(output_file, want_direct_io)) {
+      std::cout << "failed to open output file: " << output_file << std::endl;
+      return 1;
+    }
+    redirect.buf = &output_buf;
+    redirect.saved = std::cout.rdbuf(&output_buf);
+  }
+
+  // statistics, written at exit (before the output file is closed)
+  run_stats stats;
+  run_stats* st = (want_stats ? &stats : nullptr);
+  stats.engine = "none";  // set by the table solvers
+  stats.A = A;
+  stats.D = D;
+  stats.threads = num_threads;
+  perf_counters counters;
+  if (want_perf) {
+    stats.want_perf = true;
+    if (counters.open(true)) {
+      stats.perf = &counters;
+      std::string missing;
+      for (int e = 0; e < num_perf_events; e++)
+        if (!counters.has(e))
+          missing += std::string(missing.empty() ? "" : ", ") + perf_event_names[e];
+      if (!missing.empty())
+        std::cerr << "perf counters not available: " << missing << std::endl;
+    } else {
+      std::cerr << "perf counters not available (no PMU, or perf_event_paranoid)" << std::endl;
+    }
+  }
+  counting_buf counter(std::cout.rdbuf());
+  struct stats_reporter {
+    run_stats* st;
+    counting_buf* counter;
+    const char* file;
+    ~stats_reporter() {
+      if (st == nullptr)
+        return;
+      std::cout.flush();
+      st->bytes_written = counter->bytes();
+      std::cout.rdbuf(counter->target());
+      if (file == nullptr) {
+        write_run_stats(std::cerr, *st);
+      } else {
+        std::ofstream out(file);
+        write_run_stats(out, *st);
+      }
+    }
+  } reporter = {st, &counter, stats_file};
+  if (st != nullptr)
+    std::cout.rdbuf(&counter);
+
+  if (N >= 1 && want_outcomes) {
+    std::vector<std::vector<int>> dicetuples;
+    std::vector<std::vector<int>> transitions;
+    std::vector<std::vector<double>> probstable;
+    outcome_sampler S;
+    std::vector<double> dist;
+
+    if (!create_prob_table(dicetuples, transitions, probstable, uniform_dice_sides, false) ||
+        !build_outcome_sampler(S, A, A, D, D, dicetuples, transitions, probstable) ||
+        !outcome_distribution(A, D, dicetuples, transitions, probstable, dist)) 
+    {
+      std::cout << "outcome sampler construction failed" << std::endl;
+      return 1;
+    }
+
+    // rows: P(attacker wins), E[a final], E[d final]
+    // cols: exact, alias sampler, dice simulation
+    double stats[3][3] = {{0.0}};
+    for (size_t k = 0; k < dist.size(); k++) {
+      const int af = (static_cast<int>(k) < A - 1 ? k + 2 : 1);
+      const int df = (static_cast<int>(k) < A - 1 ? 0 : k - A + 2);
+      stats[0][0] += (df == 0 ? dist[k] : 0.0);
+      stats[1][0] += dist[k] * af;
+      stats[2][0] += dist[k] * df;
+    }
+
+    std::random_device rd;
+    std::mt19937_64 gen(rd());
+    for (int i = 0; i < N; i++) {
+      int af, df;
+      sample_outcome(S, A, D, gen, &af, &df);
+      stats[0][1] += (df == 0 ? 1 : 0);
+      stats[1][1] += af;
+      stats[2][1] += df;
+      simulate_battle(A, D, uniform_dice_sides, &af, &df);
+      stats[0][2] += (df == 0 ? 1 : 0);
+      stats[1][2] += af;
+      stats[2][2] += df;
+    }
+
+    for (int r = 0; r < 3; r++) {
+      std::cout << std::setprecision(num_text_digits) << stats[r][0] << " " 
+                << stats[r][1] / N << " " << stats[r][2] / N << std::endl;
+    }
+    return finish_output(0);
+  }
+
+  if (N >= 1) {
+    int num_atk_wins = 0;
+    for (int i = 0; i < N; i++) {
+      const int atk_win = simulate_battle(A, D, uniform_dice_sides);
+      num_atk_wins += atk_win;
+    }
+    std::cout << std::setprecision(num_text_digits) << static_cast<double>(num_atk_wins) / N << std::endl;
+    return finish_output(0);
+  }
+
+  if (variants_file != nullptr) {
+    std::vector<rule_variant> variants;
+    if (!load_variants(variants_file, variants)) {
+      std::cout << "failed to load variants: " << variants_file
+                << " (lines: attacker_sides defender_sides [defender_bonus] [attacker_wins_ties],"
+                << " sides 2.." << max_variant_sides << ")" << std::endl;
+      return 1;
+    }
+    const int V = variants.size();
+    const bool ok = solve_variants(A, D, variants, num_threads,
+                                   [&](int a, const double* row) {
+                                     if (want_binary) {
+                                       write_binary(std::cout, row, static_cast<size_t>(D + 1) * V);
+                                       return true;
+                                     }
+                                     for (int d = 0; d <= D; d++) {
+                                       for (int v = 0; v < V; v++)
+                                         std::cout << std::setprecision(num_text_digits) 
+                                                   << row[static_cast<size_t>(d) * V + v] << " ";
+                                       std::cout << std::endl;
+                                     }
+                                     return true;
+                                   });
+    if (!ok) {
+      std::cout << "prob table computation failed" << std::endl;
+      return 1;
+    }
+    return finish_output(0);
+  }
+
+  std::vector<std::vector<int>> dicetuples;
+  std::vector<std::vector<int>> transitions;
+  std::vector<std::vector<double>> probstable;
+  std::vector<std::vector<std::vector<double>>> dprobstable;
+
+  bool ok = false;
+  phase_timer table_timer(st, "create_prob_table");
+  if (!want_sensitivity && attacker_faces.empty() && defender_faces.empty()) {
+    ok = create_prob_table(dicetuples, transitions, probstable, uniform_dice_sides, false);
+  } else {
+    // weighted dice (uniform unless given), normalized to sum to one
+    if (attacker_faces.empty())
+      attacker_faces.assign(uniform_dice_sides, 1.0);
+    if (defender_faces.empty())
+      defender_faces.assign(uniform_dice_sides, 1.0);
+    for (std::vector<double>* f : {&attacker_faces, &defender_faces}) {
+      double total = 0.0;
+      for (double w : *f)
+        total += w;
+      for (double& w : *f)
+        w /= total;
+    }
+    ok = create_prob_table_weighted(dicetuples, transitions, probstable, &dprobstable, attacker_faces, defender_faces);
+  }
+  table_timer.stop();
+
+  if (!ok) {
+    std::cout << "prob table computation failed" << std::endl;
+    return 1;
+  }
+
+  if (container_file != nullptr) {
+    size_t bytes = 0;
+    if (!write_container(container_file, A, D, num_threads, dicetuples, transitions, probstable, &bytes)) {
+      std::cout << "failed to write container: " << container_file << std::endl;
+      return 1;
+    }
+    // container_bytes dense_bytes
+    std::cout << bytes << " " << static_cast<size_t>(A + 1) * (D + 1) * sizeof(double) << std::endl;
+    return finish_output(0);
+  }
+
+  if (compress_eps >= 0.0) {
+    compressed_table C;
+    build_compressed_table(C, A, D, compress_eps, dicetuples, transitions, probstable);
+    // compressed_bytes dense_bytes max_error
+    std::cout << compressed_bytes(C) << " " << static_cast<size_t>(A + 1) * (D + 1) * sizeof(double) << " "
+              << std::setprecision(num_text_digits) << C.max_error << std::endl;
+    return finish_output(0);
+  }
+
+  const int calibration_size = 2048;
+
+  if (surface_tolerance > 0.0) {
+    const size_t max_surface_bytes = 1 << 20;
+    battle_approx B;
+    lookup_surface L;
+    if (!calibrate_battle_approx(B, calibration_size, 0, dicetuples, transitions, probstable)) {
+      std::cout << "calibration failed" << std::endl;
+      return 1;
+    }
+    const bool fits = build_lookup_surface(L, B, A, D, surface_tolerance, max_surface_bytes);
+    // nz nt bytes certified_max_error
+    std::cout << L.nz << " " << L.nt << " " << surface_bytes(L) << " " 
+              << std::setprecision(num_text_digits) << L.max_error << std::endl;
+    return finish_output(fits ? 0 : 1);
+  }
+
+  if (approx_limit >= 0) {
+    battle_approx B;
+    if (!calibrate_battle_approx(B, calibration_size, approx_limit, dicetuples, transitions, probstable)) {
+      std::cout << "calibration failed" << std::endl;
+      return 1;
+    }
+    double err = 0.0;
+    const double value = evaluate_battle(B, A, D, &err);
+    std::cout << std::setprecision(num_text_digits) << value << " " << err << std::endl;
+    return finish_output(0);
+  }
+
+  if (want_cell) {
+    double value = 0.0;
+    if (!direct_cell_probability(A, D, dicetuples, transitions, probstable, &value)) {
+      std::cout << "direct evaluation failed" << std::endl;
+      return 1;
+    }
+    std::cout << std::setprecision(num_text_digits) << value << std::endl;
+    return finish_output(0);
+  }
+
+  if (want_sensitivity) {
+    const int R = 1 + attacker_faces.size() + defender_faces.size();
+    stream_sensitivity_rows(A, D, dicetuples, transitions, probstable, dprobstable,
+                            [&](int a, const double* row) {
+                              if (want_binary) {
+                                write_binary(std::cout, row, static_cast<size_t>(D + 1) * R);
+                                return true;
+                              }
+                              for (int d = 0; d <= D; d++) {
+                                const double* rec = row + static_cast<size_t>(d) * R;
+                                for (int r = 0; r < R; r++)
+                                  std::cout << std::setprecision(num_text_digits) << rec[r] << " ";
+                                std::cout << std::endl;
+                              }
+                              return true;
+                            });
+    return finish_output(0);
+  }
+
+  if (rounds_truncation >= 0) {
+    const int K = rounds_truncation;
+    stream_round_rows(A, D, K, dicetuples, transitions, probstable,
+                      [&](int a, const double* row) {
+                        if (want_binary) {
+                          write_binary(std::cout, row, static_cast<size_t>(D + 1) * (K + 4));
+                          return true;
+                        }
+                        // one line per cell: mean var P(R = 0) ... P(R = K) P(R > K)
+                        for (int d = 0; d <= D; d++) {
+                          const double* rec = row + static_cast<size_t>(d) * (K + 4);
+                          for (int r = 0; r < K + 4; r++)
+                            std::cout << std::setprecision(num_text_digits) << rec[r] << " ";
+                          std::cout << std::endl;
+                        }
+                        return true;
+                      });
+    return finish_output(0);
+  }
+
+  if (!threshold_levels.empty() || want_contour) {
+    // rows are streamed; the full table is never stored
+    threshold_tables T;
+    init_thresholds(T, threshold_levels, D);
+    stream_rows(A, D, dicetuples, transitions, probstable,
+                [&](int a, const double* row) { return update_thresholds(T, a, row, D); });
+
+    // rows: 0..D, cols: d, then smallest a for each level
+    if (!threshold_levels.empty()) {
+      for (int d = 0; d <= D; d++) {
+        std::cout << d;
+        for (size_t k = 0; k < threshold_levels.size(); k++)
+          std::cout << " " << T.min_attackers[k][d];
+        std::cout << std::endl;
+      }
+    }
+
+    // polyline vertices: a d (only where the 50% level is reached for a <= A)
+    if (want_contour) {
+      for (int d = 0; d <= D; d++) {
+        if (T.contour_a[d] < 0.0)
+          continue;
+        std::cout << std::setprecision(num_text_digits) << T.contour_a[d] << " " << d << std::endl;
+      }
+    }
+    return finish_output(0);
+  }
+
+  if (!edits.empty()) {
+    dp_table T;
+    if (!solve_dp_table(T, A, D, uniform_dice_sides)) {
+      std::cout << "prob table computation failed" << std::endl;
+      return 1;
+    }
+    std::vector<std::vector<double>> edited = T.probstable;
+    for (const auto& e : edits) {
+      if (e.first < 0 || e.first >= static_cast<int>(edited.size()) ||
+          !valid_probs_row(T.dicetuples[e.first], T.transitions, e.second)) {
+        std::cout << "invalid edit of probs row " << e.first << " (needs " << T.transitions.size()
+                  << " probabilities >= 0 summing to 1, nonzero only for the outcomes of its dice)" << std::endl;
+        return 1;
+      }
+      edited[e.first] = e.second;
+    }
+    const long long recomputed = update_dp_table(T, edited);
+    if (recomputed < 0) {
+      std::cout << "invalid edited probs table" << std::endl;
+      return 1;
+    }
+    std::cerr << "recomputed " << recomputed << " of " << static_cast<long long>(A - 1) * D << " cells" << std::endl;
+
+    for (int a = 0; a <= A; a++) {
+      for (int d = 0; d <= D; d++) {
+        std::cout << std::setprecision(num_text_digits) << T.P[linear_index(a, A, d, D)] << " ";
+      }
+      std::cout << std::endl;
+    }
+    return finish_output(0);
+  }
+
+  // output selection (the default is the whole table)
+  if (selection.a1 < 0) {
+    selection.a1 = A;
+    selection.d1 = D;
+  }
+  if (select_last_row)
+    selection.a0 = selection.a1 = A;
+  if (select_last_col)
+    selection.d0 = selection.d1 = D;
+  if (selection.a0 < 0 || selection.a1 > A || selection.a0 > selection.a1 ||
+      selection.d0 < 0 || selection.d1 > D || selection.d0 > selection.d1) {
+    std::cout << "output selection outside [0.." << A << "] x [0.." << D << "]" << std::endl;
+    return 1;
+  }
+
+  solve_control control;
+  const bool controlled = (progress_seconds >= 0.0 || deadline_seconds >= 0.0);
+  control.report_seconds = progress_seconds;
+  control.deadline_seconds = deadline_seconds;
+  control.on_progress = [](const solve_progress& p) { print_progress(std::cerr, p); };
+  if (controlled) {
+    interrupt_flag = &control.cancel;
+    std::signal(SIGINT, on_interrupt);
+    std::signal(SIGTERM, on_interrupt);
+  }
+  control.begin();
+
+  // after a stop the rows written so far (0..rows_done - 1) are complete
+  auto stopped_early = [&](int rows_done) {
+    if (rows_done > selection.a1 || !(control.cancel || control.deadline_reached))
+      return false;
+    std::cerr << (control.cancel ? "interrupted" : "deadline reached") << ": rows 0.." << rows_done - 1
+              << " of 0.." << selection.a1 << " complete" << std::endl;
+    return true;
+  };
+  int rows_done = 0;
+
+  if (checkpoint_file != nullptr) {
+    if (output_file == nullptr || engine != "passes" || want_pipeline) {
+      std::cout << "--checkpoint needs --output and the default engine without --pipeline" << std::endl;
+      return 1;
+    }
+    row_checkpoint C;
+    C.A = A;
+    C.D = D;
+    const int32_t sel[6] = {selection.a0, selection.a1, selection.d0, selection.d1,
+                            selection.stride_a, selection.stride_d};
+    std::copy(sel, sel + 6, C.selection);
+    C.binary = want_binary;
+    C.probs_fingerprint = probs_fingerprint(probstable);
+    C.next_a = 0;
+    C.output_bytes = -1;
+
+    row_checkpoint saved;
+    const int loaded = (want_resume ? load_row_checkpoint(checkpoint_file, A, D, saved) : 0);
+    if (loaded != 0) {
+      if (loaded < 0 || !std::equal(sel, sel + 6, saved.selection) ||
+          saved.binary != C.binary || saved.probs_fingerprint != C.probs_fingerprint) {
+        std::cout << "checkpoint does not match the parameters: " << checkpoint_file << std::endl;
+        return 1;
+      }
+      C = saved;
+      std::cerr << "resuming at row " << C.next_a << " of " << selection.a1 << std::endl;
+    }
+
+    if (!output_buf.open_at(output_file, want_direct_io, C.output_bytes)) {
+      std::cout << "failed to open output file: " << output_file << std::endl;
+      return 1;
+    }
+    redirect.buf = &output_buf;
+    redirect.saved = (st != nullptr ? counter.retarget(&output_buf) : std::cout.rdbuf(&output_buf));
+
+    stats.engine = "stream";
+    phase_timer solve_timer(st, "solve", "output");
+    auto last_save = std::chrono::steady_clock::now();
+    // row a - 1, still intact in the rolling rows of stream_rows() (or the saved row on resume)
+    const double* prev = (C.next_a > 0 ? C.row1.data() : nullptr);
+    bool saved_ok = true;
+    rows_done = C.next_a;
+    stream_rows(selection.a1, D, dicetuples, transitions, probstable,
+                [&](int a, const double* row) {
+                  if (row_selected(selection, a)) {
+                    phase_timer output_timer(st, "output");
+                    write_selected_row(std::cout, row, selection, want_binary, num_text_digits);
+                  }
+                  rows_done = a + 1;
+                  stats.cells = static_cast<long long>(rows_done - C.next_a) * (D + 1);
+                  const bool keep_going = control.update(static_cast<long long>(a + 1) * (D + 1),
+                                                         static_cast<long long>(selection.a1 + 1) * (D + 1));
+                  const auto now = std::chrono::steady_clock::now();
+                  if (a >= 1 && a < selection.a1 && 
+                      (!keep_going || std::chrono::duration<double>(now - last_save).count() >= checkpoint_seconds)) {
+                    off_t bytes = 0;
+                    std::cout.flush();
+                    C.next_a = a + 1;
+                    C.row2.assign(prev, prev + D + 1);
+                    C.row1.assign(row, row + D + 1);
+                    saved_ok = output_buf.persist(&bytes);
+                    C.output_bytes = bytes;
+                    saved_ok = saved_ok && save_row_checkpoint(checkpoint_file, C);
+                    last_save = std::chrono::steady_clock::now();
+                  }
+                  prev = row;
+                  return saved_ok && keep_going;
+                },
+                C.next_a, C.row1.data(), C.row2.data());
+    if (!saved_ok) {
+      std::cerr << "failed to write checkpoint: " << checkpoint_file << std::endl;
+      return 1;
+    }
+    if (stopped_early(rows_done))
+      return finish_output(2);
+    // the checkpoint goes only once the output is known to be complete on disk
+    if (!redirect.close())
+      return 1;
+    std::remove(checkpoint_file);  // complete; nothing left to resume
+    return finish_output(0);
+  }
+
+  if (want_tune) {
+    const tune_config best = autotune(A, D, num_threads, dicetuples, transitions, probstable, std::cout);
+    if (best.ns_per_cell < 0.0) {
+      std::cout << "no configuration could be timed" << std::endl;
+      return 1;
+    }
+    std::cout << "best: " << best.engine << " " << best.layout << " " << best.tile << " " << best.threads << " "
+              << std::setprecision(4) << best.ns_per_cell << std::endl;
+    if (!save_tune_config(tune_file, tune_machine_key(), tune_shape_key(A, D), best)) {
+      std::cout << "failed to write the tuning file: " << tune_file << std::endl;
+      return 1;
+    }
+    return finish_output(0);
+  }
+
+  // the tuned configuration of this machine and grid shape (--tune) for plain full table
+  // solves; streamed, controlled and pipelined runs keep the engine that supports them fully
+  tune_config tuned;
+  if (!explicit_config && !has_selection && !controlled && !want_pipeline &&
+      load_tune_config(tune_file, tune_machine_key(), tune_shape_key(A, D), tuned)) {
+    num_threads = std::max(1, tuned.threads);
+    stats.threads = num_threads;
+    if (tuned.engine == "tiled") {
+      layout_name = tuned.layout;
+      tile_size = tuned.tile;
+    } else {
+      engine = tuned.engine;
+    }
+  }
+
+  if (want_layout_bench) {
+    // discards everything written to it
+    struct null_buf : public std::streambuf {
+      std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+      int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+    } sink_buf;
+    std::ostream sink(&sink_buf);
+    auto bench = [&](const auto& L) {
+      const auto t0 = std::chrono::steady_clock::now();
+      grid_arena arena;
+      double* P = (arena.reserve(L.size() * sizeof(double), grid_pages) ? arena.allocate_doubles(L.size()) : nullptr);
+      if (P == nullptr)
+        return;
+      first_touch_tiles(L, P, tile_size, num_threads, arena.page_bytes());
+      solve_tiled(L, P, tile_size, num_threads, dicetuples, transitions, probstable);
+      const auto t1 = std::chrono::steady_clock::now();
+      for_each_layout_row(L, P, selection,
+                          [&](int a, const double* row) { write_selected_row(sink, row, selection, true, num_text_digits); });
+      const auto t2 = std::chrono::steady_clock::now();
+      std::cout << L.name() << " " << std::chrono::duration<double>(t1 - t0).count() << " "
+                << std::chrono::duration<double>(t2 - t1).count() << std::endl;
+    };
+    bench(layout_d_major(A, D));
+    bench(layout_a_major(A, D));
+    bench(layout_skewed(A, D));
+    bench(layout_morton(A, D));
+    return finish_output(0);
+  }
+
+  if (!layout_name.empty()) {
+    auto solve_and_write = [&](const auto& L) {
+      grid_arena arena;
+      double* P = (arena.reserve(L.size() * sizeof(double), grid_pages) ? arena.allocate_doubles(L.size()) : nullptr);
+      if (P == nullptr) {
+        std::cout << "failed to allocate " << L.size() * sizeof(double) << " bytes" << std::endl;
+        return false;
+      }
+      stats.engine = "tiled-" + layout_name;
+      {
+        phase_timer timer(st, "boundary_init");
+        first_touch_tiles(L, P, tile_size, num_threads, arena.page_bytes());
+      }
+      {
+        phase_timer timer(st, "solve");
+        rows_done = solve_tiled(L, P, tile_size, num_threads, dicetuples, transitions, probstable,
+                                (controlled ? &control : nullptr), (stats.perf != nullptr ? &stats.tiles : nullptr));
+      }
+      stats.cells = static_cast<long long>(rows_done) * (D + 1);
+      if (want_page_stats) {
+        arena_page_stats st;
+        if (arena.page_stats(st)) {
+          const char* mode_names[] = {"normal", "transparent", "huge"};
+          std::cerr << "pages: mode = " << mode_names[st.mode] << ", bytes = " << st.bytes
+                    << ", rss_kb = " << st.rss_kb << ", anon_huge_kb = " << st.anon_huge_kb
+                    << ", hugetlb_kb = " << st.hugetlb_kb << ", sampled pages per node =";
+          for (size_t n = 0; n < st.node_pages.size(); n++)
+            std::cerr << " " << n << ":" << st.node_pages[n];
+          std::cerr << std::endl;
+        }
+      }
+      std::unique_ptr<output_pipeline> pipe;
+      if (want_pipeline)
+        pipe.reset(new output_pipeline(std::cout, selection, want_binary, num_text_digits, num_threads, 64));
+      phase_timer output_timer(st, "output");
+      output_selection done = selection;
+      done.a1 = std::min(selection.a1, rows_done - 1);
+      if (done.a1 >= done.a0) {
+        for_each_layout_row(L, P, done,
+                            [&](int a, const double* row) {
+                              if (pipe != nullptr)
+                                pipe->push(row);
+                              else
+                                write_selected_row(std::cout, row, selection, want_binary, num_text_digits);
+                            });
+      }
+      pipe.reset();  // drains the queue before the output is closed
+      return true;
+    };
+    bool solved = false;
+    if (layout_name == "d-major") {
+      solved = solve_and_write(layout_d_major(A, D));
+    } else if (layout_name == "a-major") {
+      solved = solve_and_write(layout_a_major(A, D));
+    } else if (layout_name == "skewed") {
+      solved = solve_and_write(layout_skewed(A, D));
+    } else if (layout_name == "morton") {
+      solved = solve_and_write(layout_morton(A, D));
+    } else {
+      std::cout << "unknown layout: " << layout_name << std::endl;
+    }
+    if (!solved)
+      return 1;
+    return finish_output(stopped_early(rows_done) ? 2 : 0);
+  }
+
+  if (want_pipeline && engine == "passes") {
+    // rows go from the streaming solver straight into the output pipeline
+    const int queue_rows = 64;
+    output_pipeline pipe(std::cout, selection, want_binary, num_text_digits, num_threads, queue_rows);
+    stats.engine = "stream";
+    {
+      phase_timer solve_timer(st, "solve", "output");
+      stream_rows(selection.a1, D, dicetuples, transitions, probstable,
+                  controlled_rows(control, selection.a1, D,
+                                  [&](int a, const double* row) {
+                                    if (row_selected(selection, a)) {
+                                      phase_timer output_timer(st, "output");
+                                      pipe.push(row);
+                                    }
+                                    rows_done = a + 1;
+                                    return true;
+                                  }));
+    }
+    {
+      phase_timer output_timer(st, "output");
+      pipe.finish();
+    }
+    stats.cells = static_cast<long long>(rows_done) * (D + 1);
+    return finish_output(stopped_early(rows_done) ? 2 : 0);
+  }
+
+  if ((has_selection || controlled) && engine == "passes") {
+    // stream the rows (same values as the passes) and stop after the last selected one
+    stats.engine = "stream";
+    {
+      phase_timer solve_timer(st, "solve", "output");
+      stream_rows(selection.a1, D, dicetuples, transitions, probstable,
+                  controlled_rows(control, selection.a1, D,
+                                  [&](int a, const double* row) {
+                                    if (row_selected(selection, a)) {
+                                      phase_timer output_timer(st, "output");
+                                      write_selected_row(std::cout, row, selection, want_binary, num_text_digits);
+                                    }
+                                    rows_done = a + 1;
+                                    return true;
+                                  }));
+    }
+    stats.cells = static_cast<long long>(rows_done) * (D + 1);
+    return finish_output(stopped_early(rows_done) ? 2 : 0);
+  }
+
+  phase_timer init_timer(st, "boundary_init");
+  const double unused_value = -1.0;
+  const int sz = (1 + A) * (1 + D);
+
+  std::vector<double> P(sz, 0.0);
+
+  for (int i = 0; i <= A; i++) {
+    for (int j = 0; j <= D; j++) {
+      int k = linear_index(i, A, j, D);
+      P.data()[k] = unused_value;
+    }
+  }
+
+  // Set boundary conditions
+
+  for (int j = 0; j <= D; j++) {
+    P.data()[linear_index(0, A, j, D)] = 0.0;
+    P.data()[linear_index(1, A, j, D)] = 0.0;
+  }
+
+  for (int i = 2; i <= A; i++) {
+    P.data()[linear_index(i, A, 0, D)] = 1.0;
+  }
+
+  init_timer.stop();
+
+  int elems_total = 0;
+  int passes = 0;
+  stats.engine = engine;
+  phase_timer solve_timer(st, "solve");
+
+  if (engine == "scan") {
+    // columns are contiguous in the d-major storage
+    const bool complete =
+      solve_columns_scan(A, D, dicetuples, transitions, probstable, num_threads,
+                         [&](int d, const double* column) {
+                           std::copy(column, column + A + 1, P.begin() + linear_index(0, A, d, D));
+                           return !controlled || control.update(static_cast<long long>(d + 1) * (A + 1), sz);
+                         });
+    // no row is complete before the last column
+    if (!complete && stopped_early(0))
+      return finish_output(2);
+    elems_total = (A - 1) * D;
+  } else if (engine != "passes") {
+    std::cout << "unknown engine: " << engine << std::endl;
+    return 1;
+  }
+
+  while (engine == "passes") {
+    trace_span span("pass", "pass", passes);
+    const int elems = update_elements(A, 
+                                      D, 
+                                      P,
+                                      unused_value,
+                                      dicetuples,
+                                      transitions,
+                                      probstable);
+    passes += 1;
+    if (elems == 0)
+      break;
+
+    elems_total += elems;
+  }
+  solve_timer.stop();
+  stats.passes = passes;
+  stats.cells = sz;
+
+  if (elems_total != (A - 1) * D) {
+    std::cout << "DP calculation failed (passes = " << passes << ")" << std::endl;
+    return 1;
+  }
+
+  // finally write results to standard output 
+  // (supposed to be redirected into a file)
+  // rows: 0..A, cols: 0..D
+
+  // P is d-major (linear_index()); rows are gathered in cache blocks
+  phase_timer output_timer(st, "output");
+  std::unique_ptr<output_pipeline> pipe;
+  if (want_pipeline)
+    pipe.reset(new output_pipeline(std::cout, selection, want_binary, num_text_digits, num_threads, 64));
+  for_each_layout_row(layout_d_major(A, D), P.data(), selection,
+                      [&](int a, const double* row) {
+                        if (pipe != nullptr)
+                          pipe->push(row);
+                        else
+                          write_selected_row(std::cout, row, selection, want_binary, num_text_digits);
+                      });
+  pipe.reset();  // drains the queue before the output is closed
+
+  return finish_output(0);
+}
+
+#endif